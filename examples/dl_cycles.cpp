@@ -0,0 +1,96 @@
+// dl_cycles.cpp
+// Copyright (c) 2013 Jean-Louis Leroy
+// Distributed under the Boost Software License, Version 1.0. (See
+// accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+// Loads and unloads the library of dl_main.cpp repeatedly, and measures
+// the cost of initialize() after each load and each unload.
+
+#include <yorel/multi_methods.hpp>
+#include "dl.hpp"
+
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <string>
+#include <dlfcn.h>
+
+using namespace std;
+using namespace std::chrono;
+using yorel::multi_methods::virtual_;
+
+BEGIN_SPECIALIZATION(encounter, string, const Animal&, const Animal&) {
+  return "ignore";
+} END_SPECIALIZATION;
+
+BEGIN_SPECIALIZATION(encounter, string, const Herbivore&, const Carnivore&) {
+  return "run";
+} END_SPECIALIZATION;
+
+void post(const string& description, double microsecs) {
+  cout << setw(50) << left << description << ": "
+       << setw(8) << fixed << right << setprecision(3) << microsecs << endl;
+}
+
+int main(int argc, char** argv) {
+  const string path = string(argc > 1 ? argv[1] : ".") +
+#ifdef __APPLE__
+      "/libdl_cycles_shared.dylib";
+#else
+      "/libdl_cycles_shared.so";
+#endif
+  const int cycles = argc > 2 ? stoi(argv[2]) : 200;
+
+  yorel::multi_methods::initialize();
+
+  using make_tiger_type = Animal* (*)();
+  duration<double, micro> load, initialize_loaded, unload, initialize_unloaded;
+  int wrong = 0;
+
+  for (int cycle = 0; cycle < cycles; cycle++) {
+    auto start = steady_clock::now();
+    void* handle = dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+    auto loaded = steady_clock::now();
+
+    if (!handle) {
+      cout << "dlopen() failed: " << dlerror() << "\n";
+      return 1;
+    }
+
+    yorel::multi_methods::initialize();
+    auto initialized = steady_clock::now();
+    load += loaded - start;
+    initialize_loaded += initialized - loaded;
+
+    auto make_tiger = reinterpret_cast<make_tiger_type>(dlsym(handle, "make_tiger"));
+    Animal* tiger = make_tiger();
+    wrong += encounter(Cow(), *tiger) != "run";
+    wrong += encounter(*tiger, Cow()) != "hunt";
+    delete tiger;
+
+    start = steady_clock::now();
+    dlclose(handle);
+    auto unloaded = steady_clock::now();
+    yorel::multi_methods::initialize();
+    initialized = steady_clock::now();
+    unload += unloaded - start;
+    initialize_unloaded += initialized - unloaded;
+
+    // the specialization for Carnivore went away with the library
+    wrong += encounter(Wolf(), Cow()) != "ignore";
+  }
+
+  cout << cycles << " load/unload cycles, time in microsecs per cycle\n";
+  post("dlopen()", load.count() / cycles);
+  post("initialize() after load", initialize_loaded.count() / cycles);
+  post("dlclose()", unload.count() / cycles);
+  post("initialize() after unload", initialize_unloaded.count() / cycles);
+
+  if (wrong) {
+    cout << wrong << " wrong dispatches\n";
+    return 1;
+  }
+
+  return 0;
+}
@@ -28,20 +28,43 @@
 #include <memory>
 #include <algorithm>
 #include <stdexcept>
+#include <limits>
+#include <cstdint>
+#include <atomic>
+#include <mutex>
+#include <future>
 #include <iostream>
+#include <string>
 
-//#define YOMM11_ENABLE_TRACE
+#include <yorel/methods/probes.hpp>
 
-#ifdef YOMM11_ENABLE_TRACE
-#define YOMM11_TRACE(e) e
-#define YOMM11_COMMA_TRACE(e) , e
-#include <iterator>
-#else
-#define YOMM11_TRACE(e)
-#define YOMM11_COMMA_TRACE(e)
-#include <iterator>
+// YOMM11_COMPACT_DISPATCH selects a compact encoding of the dispatch
+// data: mm table entries are 32-bit group indices and dispatch table
+// cells are 32-bit indices into a per-method array of targets. It
+// halves the size of the tables, at the cost of one more indirection
+// per call. The library and its clients must agree on the setting.
+//#define YOMM11_COMPACT_DISPATCH
+
+// YOMM11_NUMA_REPLICAS lets initialize() keep one copy of the dispatch
+// data on each NUMA node - see enable_numa_replicas(). Calls read the
+// copy selected by the calling thread, at the cost of a thread-local
+// read per call. The library and its clients must agree on the setting.
+//#define YOMM11_NUMA_REPLICAS
+
+#ifndef YOMM11_MAX_NUMA_NODES
+#define YOMM11_MAX_NUMA_NODES 8
 #endif
 
+// YOMM11_ENABLE_PROFILE counts the calls that go through each dispatch
+// cell, in storage private to each thread - see dump_profile(). The
+// library and its clients must agree on the setting.
+//#define YOMM11_ENABLE_PROFILE
+
+// YOMM11_ENABLE_PROBES places static tracepoints in initialize() and
+// in the error thunks - see probes.hpp.
+
+#include <iterator>
+
 // Copied from Boost.
 #ifdef _MSVC_VER
 #pragma warning( push )
@@ -56,18 +79,29 @@ namespace methods {
 // Forward declarations.
 // All names in namespace are listed below.
 void initialize();
+std::future<void> initialize_async();
 struct selector;
 template<class Class> struct virtual_;
 class undefined;
 class ambiguous;
-
-#ifdef YOMM11_ENABLE_TRACE
-std::ostream& operator <<(std::ostream& os, const yomm11_class* pc);
-std::ostream& operator <<(std::ostream& os, const std::vector<yomm11_class*>& classes);
-std::ostream& operator <<(std::ostream& os, specialization_base* method);
-std::ostream& operator <<(std::ostream& os, const std::vector<specialization_base*>& methods);
-std::ostream& operator <<(std::ostream& os, const method_base* pc);
+struct method_statistics;
+struct memory_statistics;
+memory_statistics memory_stats();
+void write_dispatch_report(std::ostream& os);
+void enable_huge_pages(bool enable = true);
+void enable_numa_replicas(bool enable = true);
+int select_replica();
+void select_replica(int node);
+void freeze();
+bool is_frozen();
+void set_parallel_threads(int threads);
+#ifdef YOMM11_ENABLE_PROFILE
+void dump_profile(std::ostream& os);
+void reset_profile();
 #endif
+void register_thread();
+void unregister_thread();
+void quiescent_state();
 
 // End of forward declarations.
 
@@ -130,19 +164,19 @@ class bitvec {
     ref(word* p, int i) : p(p), i(i) {
     }
     operator bool() const {
-      return (p[i / bpw] & (1 << (i % bpw))) != 0;
+      return (p[i / bpw] & (word(1) << (i % bpw))) != 0;
     }
     ref& operator =(bool val) {
       if (val) {
-        p[i / bpw] |= 1 << (i % bpw);
+        p[i / bpw] |= word(1) << (i % bpw);
       } else {
-        p[i / bpw] &= ~(1 << (i % bpw));
+        p[i / bpw] &= ~(word(1) << (i % bpw));
       }
       return *this;
     }
     ref& operator |=(bool val) {
       if (val) {
-        p[i / bpw] |= 1 << (i % bpw);
+        p[i / bpw] |= word(1) << (i % bpw);
       }
       return *this;
     }
@@ -177,6 +211,8 @@ class bitvec {
 
   int size() const { return n; }
 
+  std::size_t bytes() const { return wsize(n) * sizeof(word); }
+
   void resize(int size) {
     size_t new_ws = wsize(size);
     word* new_p = new word[new_ws];
@@ -185,7 +221,7 @@ class bitvec {
     std::fill(end, new_p + new_ws, 0);
     if (size < n) {
       if (size_t rem = size % bpw) {
-        end[-1] &= (1 << rem) - 1;
+        end[-1] &= (word(1) << rem) - 1;
       }
     }
     delete [] p;
@@ -198,7 +234,7 @@ class bitvec {
   }
 
   bool operator [](int i) const {
-    return (p[i / bpw] & (1 << (i % bpw))) != 0;
+    return (p[i / bpw] & (word(1) << (i % bpw))) != 0;
   }
 
   ref operator [](int i) { return ref(p, i); }
@@ -234,7 +270,7 @@ class bitvec {
         wbegin(), wend(), res.wbegin(),
         [](word w) { return ~w; });
     if (size_t rem = n % bpw) {
-      res_last[-1] &= (1 << rem) - 1;
+      res_last[-1] &= (word(1) << rem) - 1;
     }
     return res;
   }
@@ -259,48 +295,182 @@ std::ostream& operator <<(std::ostream& os, const bitvec& v);
 template<typename... T>
 struct type_list;
 
+// Guards the classes, methods and specializations known to the
+// library. initialize() holds it throughout, and so do the destructors
+// that run when a shared object is unloaded. Recursive, because
+// initialize() constructs the descriptors of the classes it meets for
+// the first time.
+std::recursive_mutex& registry_mutex();
+
+#ifdef YOMM11_NUMA_REPLICAS
+// the copy of the dispatch data that the calling thread reads
+extern thread_local int replica;
+#endif
+
+// A class or specialization registered during static initialization.
+// Constructing a node only links it in a list - no allocation, no
+// hashing. initialize() runs the pending nodes in registration order.
+//
+// The nodes are initialized dynamically, not constantly: a node that no
+// code runs for cannot be found later - nothing refers to a
+// specialization before initialize() - short of a linker section, which
+// is not portable. The class node also sets yomm11_class::of<C>::pc,
+// which MM_INIT reads without a check in every constructor of C; making
+// MM_INIT call of<C>::the() instead would put a guard on that path.
+struct registration {
+  explicit registration(void (*process)());
+  ~registration();
+  registration(const registration&) = delete;
+  registration& operator =(const registration&) = delete;
+
+  void defer();
+  // the caller holds 'mutex'
+  void link();
+  void unlink();
+
+  static registration* pop();
+  static void run_pending();
+
+  void (*process)();
+  bool linked;
+  registration* prev;
+  registration* next;
+
+  static registration* first;
+  static registration* last;
+  // Guards the pending list and yomm11_class::registered. Static
+  // constructors take only this one, so loading a shared object never
+  // waits for initialize().
+  static std::mutex mutex;
+};
+
+// MM_CLASS and MULTI_METHOD declare an overload for their class or
+// method, found by argument-dependent lookup. This one is used for the
+// others, e.g. foreign classes: MM_FOREIGN_CLASS is often called outside
+// the namespace of the class, so it passes the name to the initializer
+// instead.
+template<class T>
+const char* _yomm11_name_(T*) {
+  return typeid(T).name();
+}
+
 struct yomm11_class {
   struct method_param {
     method_base* method;
     int arg;
   };
 
+#ifdef YOMM11_COMPACT_DISPATCH
+  union offset {
+    std::int32_t index;
+  };
+#else
   union offset {
     int index;
     void (**ptr)();
   };
+#endif
 
-  yomm11_class(YOMM11_TRACE(const char* name));
+  // The multi-method table of a class. Dispatch reads the published
+  // entries. initialize() writes to a private draft, then publishes it
+  // with an atomic swap, so a thread that dispatches meanwhile sees
+  // either the old row or the new one. The entries live on the heap
+  // until initialize() packs them into the dispatch arena, where
+  // classes with identical tables share the same entries.
+  struct mm_table {
+    mm_table() : entries(nullptr), draft(nullptr), n(0) {
+#ifdef YOMM11_NUMA_REPLICAS
+      for (auto& copy : replicas) {
+        copy.store(nullptr, std::memory_order_relaxed);
+      }
+#endif
+    }
+    ~mm_table();
+    mm_table(const mm_table&) = delete;
+    mm_table& operator =(const mm_table&) = delete;
+
+    int size() const { return n; }
+    void resize(int size);
+    void make_draft();
+    void publish();
+    void publish(offset* new_entries);
+    // what dispatch reads
+    const offset* dispatch_entries() const {
+#ifdef YOMM11_NUMA_REPLICAS
+      return replicas[replica].load(std::memory_order_acquire);
+#else
+      return entries.load(std::memory_order_acquire);
+#endif
+    }
+    offset* latest() const { return draft ? draft : entries.load(std::memory_order_relaxed); }
+    offset& operator [](int i) {
+      if (!draft) {
+        make_draft();
+      }
+      return draft[i];
+    }
+    const offset& operator [](int i) const { return latest()[i]; }
+
+    std::atomic<offset*> entries;
+#ifdef YOMM11_NUMA_REPLICAS
+    // the entries in the copy of the dispatch data on each node; the
+    // same as 'entries' until initialize() makes copies
+    std::atomic<offset*> replicas[YOMM11_MAX_NUMA_NODES];
+#endif
+    offset* draft;
+    int n; // size of the latest version
+  };
+
+  explicit yomm11_class(const char* name = nullptr);
   ~yomm11_class();
 
-  void initialize(const std::vector<yomm11_class*>& bases);
+  bool initialize(const std::vector<yomm11_class*>& bases);
+  bool make_ready();
   void add_method(method_base* pm, int arg);
   void remove_method(method_base* pm);
+  // unlinks the class from the registry, with its methods and the
+  // specializations that name it
+  void unregister();
   void for_each_spec(std::function<void(yomm11_class*)> pf);
   void for_each_conforming(std::function<void(yomm11_class*)> pf);
   void for_each_conforming(std::unordered_set<const yomm11_class*>& visited, std::function<void(yomm11_class*)> pf);
   bool conforms_to(const yomm11_class& other) const;
   bool specializes(const yomm11_class& other) const;
   bool is_root() const;
-  YOMM11_TRACE(const char* name);
+  const char* name;
   std::vector<yomm11_class*> bases;
   std::vector<yomm11_class*> specs;
   detail::bitvec mask;
   int index;
   yomm11_class* root;
-  std::vector<yomm11_class::offset> mmt;
+  mm_table mmt;
   std::vector<method_param> rooted_here; // methods rooted here for one or more args.
   bool abstract;
+  // pending registration; run on demand if a subclass is processed
+  // first. Guarded by registration::mutex.
+  registration* registered;
+
+  // Gives each class registered since the last initialize() the row of
+  // a class to which the same specializations of every method apply,
+  // so that its objects dispatch right with the current tables. False
+  // if there is no such class for one of them.
+  static bool make_provisional_rows();
 
   static std::unordered_set<yomm11_class*>* to_initialize;
   static void add_to_initialize(yomm11_class* pc);
   static void remove_from_initialize(yomm11_class* pc);
 
+  // all live classes, in registration order
+  static yomm11_class* first;
+  static yomm11_class* last;
+  yomm11_class* prev;
+  yomm11_class* next;
+
   template<class Class>
   struct of {
     static yomm11_class* pc;
     static yomm11_class& the() {
-      static yomm11_class instance YOMM11_TRACE({_yomm11_name_((Class*) nullptr)});
+      static yomm11_class instance(_yomm11_name_((Class*) nullptr));
       pc = &instance;
       return instance;
     }
@@ -316,8 +486,12 @@ struct yomm11_class {
   struct initializer;
 
   template<class Class, class... Bases>
-  struct initializer<Class, type_list<Bases...>> {
+  struct initializer<Class, type_list<Bases...>> : registration {
     initializer();
+    // for MM_FOREIGN_CLASS, which may not be in the namespace of Class
+    explicit initializer(const char* name);
+    ~initializer();
+    static void process();
     static initializer the;
   };
 };
@@ -334,35 +508,202 @@ struct specialization_base {
 
   int index; // inside method
   std::vector<yomm11_class*> args;
+#ifdef YOMM11_ENABLE_PROFILE
+  // calls counted before the dispatch table was last re-computed
+  std::uint64_t calls = 0;
+#endif
   bool specializes(specialization_base* other) const;
   static specialization_base undefined;
   static specialization_base ambiguous;
 };
 
+// true if p points inside the dispatch arena built by initialize()
+bool in_arena(const void* p);
+
+// Hands over memory that threads dispatching concurrently may still be
+// reading. It is released once every registered thread has passed a
+// quiescent state - at once if no thread is registered. Null pointers
+// and pointers inside the arena are ignored.
+void retire(void* p, void (*release)(void*, std::size_t), std::size_t size = 0);
+
+template<typename T>
+void retire_array(T* p) {
+  retire(const_cast<void*>(static_cast<const void*>(p)), [](void* q, std::size_t) { delete [] static_cast<T*>(q); });
+}
+
+// Access to the dispatch cells and the next pointers, which threads
+// dispatching concurrently may be reading while a specialization is
+// swapped in. Plain cells go through the atomic builtins on both sides.
+template<typename T, typename U>
+void store_release(T& location, U value) {
+  __atomic_store_n(&location, static_cast<T>(value), __ATOMIC_RELEASE);
+}
+
+template<typename T, typename U>
+void store_release(std::atomic<T>& location, U value) {
+  location.store(static_cast<T>(value), std::memory_order_release);
+}
+
+template<typename T>
+T load_acquire(const T& location) {
+  return __atomic_load_n(&location, __ATOMIC_ACQUIRE);
+}
+
+template<typename T>
+T load_acquire(const std::atomic<T>& location) {
+  return location.load(std::memory_order_acquire);
+}
+
 struct method_base {
-  explicit method_base(const std::vector<yomm11_class*>& v YOMM11_COMMA_TRACE(const char* name));
+  method_base(const std::vector<yomm11_class*>& v, const char* name);
   virtual ~method_base();
 
   using void_function_pointer = void (*)();
+#ifdef YOMM11_COMPACT_DISPATCH
+  using dispatch_cell = std::uint32_t;
+#else
+  using dispatch_cell = void_function_pointer;
+#endif
+
+  // What the dispatch code reads: the dispatch table - and, in compact
+  // mode, the targets - followed by the slot and step of each virtual
+  // argument, interleaved. Replaced as a whole and published with an
+  // atomic swap whenever the table is rebuilt.
+  struct header {
+    dispatch_cell* table;
+#ifdef YOMM11_COMPACT_DISPATCH
+    void_function_pointer* targets;
+#endif
+    const int* slots_and_steps() const { return reinterpret_cast<const int*>(this + 1); }
+    int* slots_and_steps() { return reinterpret_cast<int*>(this + 1); }
+    static std::size_t size(int dims) { return sizeof(header) + 2 * dims * sizeof(int); }
+  };
 
   void resolve();
-  virtual void_function_pointer* allocate_dispatch_table(int size) = 0;
+  void publish();
+  // replaces the header in all the copies of the dispatch data
+  const header* exchange_header(const header* new_header);
+  // copies the given cells - and target - to the other copies
+  void replicate_cells(const std::vector<int>& cells, int target);
+  const header* dispatch_header() const {
+#ifdef YOMM11_NUMA_REPLICAS
+    return replicas[replica].load(std::memory_order_acquire);
+#else
+    return dispatch.load(std::memory_order_acquire);
+#endif
+  }
+  virtual dispatch_cell* allocate_dispatch_table(int size) = 0;
+  virtual dispatch_cell* get_dispatch_table() const = 0;
+  virtual void set_dispatch_table(dispatch_cell* table) = 0;
+#ifdef YOMM11_COMPACT_DISPATCH
+  // targets[0] throws undefined, targets[1] throws ambiguous, then
+  // one target per specialization
+  int targets_size() const { return methods.size() + 2; }
+  virtual void_function_pointer* get_targets() const = 0;
+  virtual void set_targets(void_function_pointer* targets) = 0;
+#endif
   virtual void emit(specialization_base*, int i) = 0;
   virtual void emit_next(specialization_base*, specialization_base*) = 0;
+  virtual std::size_t specialization_size() const = 0;
   void invalidate();
+  void invalidate_shared_slots();
   void assign_slot(int arg, int slot);
+  void remove_spec(specialization_base* spec);
+  void remove_specs_using(const yomm11_class* pc);
+  // adds spec, re-computing only the cells that it changes; throws if
+  // it would change the groups. Returns the indexes of the cells.
+  std::vector<int> insert_in_place(specialization_base* spec);
+  // Called when a class the method dispatches on is unloaded. The
+  // object stays - method<> still points to it - but leaves the
+  // registry, and its dispatch table throws undefined.
+  void bury();
 
   std::vector<yomm11_class*> vargs;
   std::vector<int> slots;
+  // true if the slot is also used by other methods
+  std::vector<bool> shared_slots;
   std::vector<specialization_base*> methods;
   std::vector<int> steps;
-  YOMM11_TRACE(const char* name);
+  std::atomic<const header*> dispatch;
+#ifdef YOMM11_NUMA_REPLICAS
+  std::atomic<const header*> replicas[YOMM11_MAX_NUMA_NODES];
+#endif
+  const char* name;
+  bool buried;
+
+  // filled by the resolver
+  std::vector<int> groups; // per dimension
+  int table_size;
+  int undefined_cells;
+  int ambiguous_cells;
+
+#ifdef YOMM11_ENABLE_PROFILE
+  std::size_t profile_id; // index of the counters of the method
+  // the specialization that each cell leads to
+  std::vector<specialization_base*> profile_cells;
+  std::uint64_t undefined_calls, ambiguous_calls;
+#endif
 
   static std::unordered_set<method_base*>* to_initialize;
   static void add_to_initialize(method_base* pm);
   static void remove_from_initialize(method_base* pm);
+
+  // all live methods, in creation order
+  static method_base* first;
+  static method_base* last;
+  method_base* prev;
+  method_base* next;
 };
 
+#ifdef YOMM11_ENABLE_PROFILE
+// Each thread counts the calls that go through each cell of each
+// method in counters of its own, padded to cache lines. The counters
+// of all the threads are added up when the profile is dumped, and when
+// a dispatch table is about to be re-computed - its counts then go to
+// the specializations that the cells led to.
+struct profile {
+  struct cells {
+    std::atomic<std::uint64_t>* counts; // written by the owner only
+    std::size_t size;
+    char* memory; // as allocated
+    // counts already credited to specializations, by readers
+    std::vector<std::uint64_t> folded;
+  };
+
+  struct thread_counters {
+    std::vector<cells> methods; // indexed by profile_id
+    std::mutex mutex; // held while 'methods' grows, and by readers
+    thread_counters* next;
+  };
+
+  static thread_counters& local() {
+    thread_local thread_counters* counters = add_thread();
+    return *counters;
+  }
+
+  static void count(const method_base* pm, std::size_t cell) {
+    auto& counters = local();
+
+    if (pm->profile_id >= counters.methods.size() || cell >= counters.methods[pm->profile_id].size) {
+      grow(counters, pm->profile_id, cell + 1);
+    }
+
+    // only this thread writes: no need for an atomic increment
+    auto& count = counters.methods[pm->profile_id].counts[cell];
+    count.store(count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+  }
+
+  static thread_counters* add_thread();
+  static void grow(thread_counters& counters, std::size_t method, std::size_t size);
+  // moves the counts of the method to its specializations
+  static void fold(method_base* pm);
+
+  static std::mutex mutex;
+  static thread_counters* threads;
+  static std::size_t methods;
+};
+#endif
+
 // Copied from Boost.
 template<typename Base, typename Derived>
 struct is_virtual_base_of
@@ -409,70 +750,121 @@ template<typename... Class>
 struct virtuals {
 };
 
-template<class... Class>
-struct extract_virtuals {
-  using type = typename extract_virtuals<virtuals<>, Class...>::type;
+// std::index_sequence is C++14. make_index_sequence halves N at each
+// step, so its depth is log N.
+template<std::size_t... I>
+struct index_sequence {
 };
 
-template<class... Head, typename Next, typename... Rest>
-struct extract_virtuals< virtuals<Head...>, Next, Rest... > {
-  using type = typename extract_virtuals< virtuals<Head...>, Rest... >::type;
+template<class First, class Second>
+struct concat_indices;
+
+template<std::size_t... I, std::size_t... J>
+struct concat_indices<index_sequence<I...>, index_sequence<J...>> {
+  using type = index_sequence<I..., (sizeof...(I) + J)...>;
 };
 
-template<class... Head, typename Next, typename... Rest>
-struct extract_virtuals< virtuals<Head...>, virtual_<Next>&, Rest... > {
-  using type = typename extract_virtuals<
-    virtuals<Head..., typename virtual_<Next>::type>,
-    Rest...
-    >::type;
+template<std::size_t N>
+struct make_index_sequence_ : concat_indices<
+  typename make_index_sequence_<N / 2>::type,
+  typename make_index_sequence_<N - N / 2>::type> {
 };
 
-template<class... Head, typename Next, typename... Rest>
-struct extract_virtuals< virtuals<Head...>, const virtual_<Next>&, Rest... > {
-  using type = typename extract_virtuals<
-    virtuals<Head..., typename virtual_<Next>::type>,
-    Rest...
-    >::type;
+template<>
+struct make_index_sequence_<0> {
+  using type = index_sequence<>;
 };
 
-template<class... Head>
-struct extract_virtuals< virtuals<Head...> > {
-  using type = virtuals<Head...>;
+template<>
+struct make_index_sequence_<1> {
+  using type = index_sequence<0>;
 };
 
-template<class Result, class Multi, class Method>
-struct extract_method_virtuals_;
+template<std::size_t N>
+using make_index_sequence = typename make_index_sequence_<N>::type;
 
-template<class Multi, class Method>
-struct extract_method_virtuals {
-  using type = typename extract_method_virtuals_<virtuals<>, Multi, Method>::type;
+template<typename P>
+struct virtual_parameter : std::false_type {
+  using type = P;
 };
 
-template<class... V, class P1, class A1, class... PN, class... AN, class R1, class R2>
-struct extract_method_virtuals_<virtuals<V...>, R1(P1, PN...), R2(A1, AN...)> {
-  using type = typename extract_method_virtuals_<
-    virtuals<V...>, R1(PN...), R2(AN...)>::type;
+template<class C>
+struct virtual_parameter<virtual_<C>&> : std::true_type {
+  using type = typename virtual_<C>::type;
 };
 
-template<class... V, class P1, class A1, class... PN, class... AN, class R1, class R2>
-struct extract_method_virtuals_<virtuals<V...>, R1(virtual_<P1>&, PN...), R2(A1&, AN...)> {
-  using type = typename extract_method_virtuals_<
-    virtuals<V..., A1>,
-    R1(PN...), R2(AN...)
-    >::type;
+template<class C>
+struct virtual_parameter<const virtual_<C>&> : std::true_type {
+  using type = typename virtual_<C>::type;
 };
 
-template<class... V, class P1, class A1, class... PN, class... AN, class R1, class R2>
-struct extract_method_virtuals_<virtuals<V...>, R1(const virtual_<P1>&, PN...), R2(const A1&, AN...)> {
-  using type = typename extract_method_virtuals_<
-    virtuals<V..., A1>,
-    R1(PN...), R2(AN...)
+template<std::size_t N>
+struct bools {
+  bool value[N + 1];
+};
+
+template<std::size_t N>
+constexpr std::size_t count_true(bools<N> b, std::size_t n) {
+  return n == 0 ? 0 : b.value[n - 1] + count_true(b, n - 1);
+}
+
+// The number of virtual parameters before the i-th one. Evaluated by
+// the compiler, not instantiated for each parameter.
+template<typename... P>
+constexpr std::size_t virtuals_before(std::size_t i) {
+  return count_true(bools<sizeof...(P)>{ { virtual_parameter<P>::value..., false } }, i);
+}
+
+template<std::size_t I, typename T>
+struct indexed {
+  using type = T;
+};
+
+template<std::size_t I, typename T>
+indexed<I, T> at(const indexed<I, T>&);
+
+template<class Keyed, class Indices>
+struct pick_virtuals;
+
+template<class Keyed, std::size_t... K>
+struct pick_virtuals<Keyed, index_sequence<K...>> {
+  using type = virtuals<typename decltype(at<K>(std::declval<Keyed>()))::type...>;
+};
+
+// The T whose P is a virtual parameter, in order. The k-th virtual
+// parameter is keyed by k, the other ones by a key past the end; the
+// result picks keys 0 to the number of virtual parameters - 1.
+template<class Indices, class P, class T>
+struct filter_virtuals;
+
+template<std::size_t... I, typename... P, typename... T>
+struct filter_virtuals<index_sequence<I...>, type_list<P...>, type_list<T...>> {
+  struct keyed : indexed<
+    virtual_parameter<P>::value ? virtuals_before<P...>(I) : sizeof...(P) + I, T>... {
+  };
+  using type = typename pick_virtuals<
+    keyed, make_index_sequence<virtuals_before<P...>(sizeof...(P))>>::type;
+};
+
+template<class... P>
+struct extract_virtuals {
+  using type = typename filter_virtuals<
+    make_index_sequence<sizeof...(P)>,
+    type_list<P...>,
+    type_list<typename virtual_parameter<P>::type...>
     >::type;
 };
 
-template<class... V, class R1, class R2>
-struct extract_method_virtuals_<virtuals<V...>, R1(), R2()> {
-  using type = virtuals<V...>;
+template<class Multi, class Method>
+struct extract_method_virtuals;
+
+template<class R1, class... P, class R2, class... A>
+struct extract_method_virtuals<R1(P...), R2(A...)> {
+  using type = typename filter_virtuals<
+    make_index_sequence<sizeof...(P)>,
+    type_list<P...>,
+    type_list<typename std::remove_cv<typename std::remove_reference<A>::type>::type...>
+    >::type;
 };
 
 template<typename T>
@@ -490,28 +882,10 @@ struct remove_virtual<const virtual_<C>&> {
   using type = const C&;
 };
 
-template<class... Class> struct yomm11_class_vector_of_;
-
-template<class First, class... Rest>
-struct yomm11_class_vector_of_<First, Rest...> {
-  static void get(std::vector<yomm11_class*>& classes) {
-    classes.push_back(&yomm11_class::of<First>::the());
-    yomm11_class_vector_of_<Rest...>::get(classes);
-  }
-};
-
-template<>
-struct yomm11_class_vector_of_<> {
-  static void get(std::vector<yomm11_class*>& classes) {
-  }
-};
-
 template<class... Class>
 struct yomm11_class_vector_of {
   static std::vector<yomm11_class*> get() {
-    std::vector<yomm11_class*> classes;
-    yomm11_class_vector_of_<Class...>::get(classes);
-    return classes;
+    return { &yomm11_class::of<Class>::the()... };
   }
 };
 
@@ -528,8 +902,8 @@ struct get_mm_table;
 template<>
 struct get_mm_table<true> {
   template<class C>
-  static const std::vector<yomm11_class::offset>& value(const C* obj) {
-    return *obj->_get_yomm11_ptbl();
+  static const yomm11_class::offset* value(const C* obj) {
+    return obj->_get_yomm11_ptbl()->dispatch_entries();
   }
 };
 
@@ -567,12 +941,54 @@ struct signature {
 
 template<>
 struct get_mm_table<false> {
-  using class_of_type = std::unordered_map<std::type_index, const std::vector<yomm11_class::offset>*>;
-  static class_of_type* class_of;
+  using class_of_type = std::unordered_map<std::type_index, const yomm11_class::mm_table*>;
+  // Read-only once published. Classes registered since the last
+  // publication go to a copy, which replaces the published map.
+  static std::atomic<const class_of_type*> class_of;
+  static class_of_type* draft;
+  static void add(std::type_index type, const yomm11_class::mm_table* mmt);
+  // false if the class is not in the map
+  static bool remove(const yomm11_class::mm_table* mmt);
+  static void publish();
+  // throws undefined: the class was not registered with
+  // MM_FOREIGN_CLASS, or not yet passed to initialize()
+  [[noreturn]] static void unknown(const std::type_info& type);
+
+  // Set by freeze(): a copy of class_of, hashed with open addressing,
+  // in the read-only dispatch arena. Free entries have a null mmt.
+  struct frozen_class {
+    std::type_index type;
+    const yomm11_class::mm_table* mmt;
+  };
+  static std::atomic<const frozen_class*> frozen;
+  static std::size_t frozen_mask;
+
+  static const yomm11_class::mm_table* find(const std::type_info& type) {
+    if (auto table = frozen.load(std::memory_order_acquire)) {
+      for (std::size_t i = type.hash_code() & frozen_mask; table[i].mmt; i = (i + 1) & frozen_mask) {
+        if (table[i].type == std::type_index(type)) {
+          return table[i].mmt;
+        }
+      }
+    }
+
+    auto map = class_of.load(std::memory_order_acquire);
+
+    if (map) {
+      auto iter = map->find(std::type_index(type));
+
+      if (iter != map->end()) {
+        return iter->second;
+      }
+    }
+
+    unknown(type);
+  }
+
   template<class C>
-  static const std::vector<yomm11_class::offset>& value(const C* obj) {
-    YOMM11_TRACE(std::cout << "foreign yomm11_class::of<" << typeid(*obj).name() << "> = " << (*class_of)[std::type_index(typeid(*obj))] << std::endl);
-    return *(*class_of)[std::type_index(typeid(*obj))];
+  static const yomm11_class::offset* value(const C* obj) {
+    auto mmt = find(typeid(*obj));
+    return mmt->dispatch_entries();
   }
 };
 
@@ -630,12 +1046,24 @@ struct wrapper<M, R(P...), R(P...)> {
   using type = M;
 };
 
+// The next pointer of a specialization: a std::atomic in
+// specialization<>, a plain pointer in the hand-written ones.
+template<class Spec, typename M>
+struct next_of {
+  static M load() { return load_acquire(Spec::next); }
+  static void store(M value) { store_release(Spec::next, value); }
+};
+
 template<class M>
 struct method_impl : specialization_base {
   M pm;
-  M* pn; // next
+  const void* pn; // address of next, identifies the specialization
+  M (*load_next)();
+  void (*store_next)(M);
 
-  method_impl(int index, M pm, std::vector<yomm11_class*> type_tuple, M* pn) : pm(pm), pn(pn) {
+  template<class Spec>
+  method_impl(int index, M pm, std::vector<yomm11_class*> type_tuple, Spec*) :
+    pm(pm), pn(&Spec::next), load_next(next_of<Spec, M>::load), store_next(next_of<Spec, M>::store) {
     this->index = index;
     this->args = type_tuple;
   }
@@ -651,6 +1079,7 @@ struct throw_undefined<R(A...)> {
 
 template<typename R, typename... A>
 R throw_undefined<R(A...)>::body(A...) {
+  YOMM11_PROBE1(undefined, typeid(R(A...)).name());
   throw undefined();
 }
 
@@ -664,6 +1093,7 @@ struct throw_ambiguous<R(A...)> {
 
 template<typename R, typename... A>
 R throw_ambiguous<R(A...)>::body(A...) {
+  YOMM11_PROBE1(ambiguous, typeid(R(A...)).name());
   throw ambiguous();
 }
 
@@ -675,18 +1105,36 @@ struct method_implementation : method_base {
   using signature = R(typename remove_virtual<P>::type...);
   using virtuals = typename extract_virtuals<P...>::type;
 
-  method_implementation(YOMM11_TRACE(const char* name)) :
-    method_base(yomm11_class_vector_of<virtuals>::get() YOMM11_COMMA_TRACE(name)),
-    dispatch_table(nullptr) {
+  method_implementation(const char* name) :
+    method_base(yomm11_class_vector_of<virtuals>::get(), name),
+    dispatch_table(nullptr)
+#ifdef YOMM11_COMPACT_DISPATCH
+    , targets(nullptr)
+#endif
+  {
   }
 
   template<class M> specialization_base* add_spec();
+  template<class M, class Replacement> std::vector<int> replace_spec();
+  template<class M> std::vector<int> insert_spec();
+  template<class M> void remove_spec();
 
-  virtual void_function_pointer* allocate_dispatch_table(int size);
+  virtual dispatch_cell* allocate_dispatch_table(int size);
+  virtual dispatch_cell* get_dispatch_table() const;
+  virtual void set_dispatch_table(dispatch_cell* table);
   virtual void emit(specialization_base*, int i);
   virtual void emit_next(specialization_base*, specialization_base*);
+  virtual std::size_t specialization_size() const { return sizeof(method_entry); }
 
+#ifdef YOMM11_COMPACT_DISPATCH
+  virtual void_function_pointer* get_targets() const;
+  virtual void set_targets(void_function_pointer* targets);
+
+  dispatch_cell* dispatch_table;
+  method_pointer_type* targets;
+#else
   method_pointer_type* dispatch_table;
+#endif
 };
 
 template<typename R, typename... P>
@@ -696,174 +1144,335 @@ specialization_base* method_implementation<R, P...>::add_spec() {
   using target = typename wrapper<M, method_signature, signature>::type;
   using method_virtuals = typename extract_method_virtuals<R(P...), method_signature>::type;
 
-  using namespace std;
-  YOMM11_TRACE(cout << "add " << method_virtuals() << " to " << virtuals() << endl);
+  auto args = yomm11_class_vector_of<method_virtuals>::get();
+
+  for (auto pc : args) {
+    if (!pc->make_ready()) {
+      return nullptr;
+    }
+  }
 
-  specialization_base* method = new method_entry(methods.size(), target::body, yomm11_class_vector_of<method_virtuals>::get(), &M::next);
+  specialization_base* method = new method_entry(methods.size(), target::body, args, (M*) nullptr);
   methods.push_back(method);
   invalidate();
+  // the new specialization may split the groups that shared a slot
+  invalidate_shared_slots();
 
   return method;
 }
 
+// Swaps the body of a specialization in place: the dispatch cells and
+// the next pointers that lead to the old body are rewritten, the
+// tables stay as they are.
+template<typename R, typename... P>
+template<class M, class Replacement>
+std::vector<int> method_implementation<R, P...>::replace_spec() {
+  using method_signature = typename M::body_signature::type;
+  using target = typename wrapper<Replacement, method_signature, signature>::type;
+
+  auto entry = std::find_if(methods.begin(), methods.end(), [](specialization_base* method) {
+      return static_cast<method_entry*>(method)->pn == &M::next;
+    });
+
+  if (entry == methods.end()) {
+    throw std::runtime_error("methods: not a specialization of this method");
+  }
+
+  auto spec = static_cast<method_entry*>(*entry);
+  const method_pointer_type old_body = spec->pm;
+  const method_pointer_type new_body = target::body;
+
+  for (auto method : methods) {
+    if (method != spec && static_cast<method_entry*>(method)->pm == new_body) {
+      throw std::runtime_error("methods: body already used by another specialization");
+    }
+  }
+
+  spec->pm = new_body;
+  std::vector<int> cells;
+
+  if (dispatch_table) {
+    for (int i = 0; i < table_size; i++) {
+#ifdef YOMM11_COMPACT_DISPATCH
+      if (dispatch_table[i] == dispatch_cell(spec->index + 2)) {
+        cells.push_back(i);
+      }
+#else
+      if (dispatch_table[i] == old_body) {
+        store_release(dispatch_table[i], new_body);
+        cells.push_back(i);
+      }
+#endif
+    }
+
+#ifdef YOMM11_COMPACT_DISPATCH
+    store_release(targets[spec->index + 2], new_body);
+#endif
+  }
+
+  for (auto method : methods) {
+    auto entry = static_cast<method_entry*>(method);
+    if (entry->load_next() == old_body) {
+      entry->store_next(new_body);
+    }
+  }
+
+  replicate_cells(cells, spec->index + 2);
+
+  return cells;
+}
+
+template<typename R, typename... P>
+template<class M>
+std::vector<int> method_implementation<R, P...>::insert_spec() {
+  using method_signature = typename M::body_signature::type;
+  using target = typename wrapper<M, method_signature, signature>::type;
+  using method_virtuals = typename extract_method_virtuals<R(P...), method_signature>::type;
+
+  auto args = yomm11_class_vector_of<method_virtuals>::get();
+
+  for (auto pc : args) {
+    if (!pc->make_ready()) {
+      throw std::runtime_error("methods: class not registered yet");
+    }
+  }
+
+  for (auto method : methods) {
+    if (static_cast<method_entry*>(method)->pn == &M::next) {
+      throw std::runtime_error("methods: already a specialization of this method");
+    }
+  }
+
+  return insert_in_place(new method_entry(methods.size(), target::body, args, (M*) nullptr));
+}
+
 template<typename R, typename... P>
-method_base::void_function_pointer* method_implementation<R, P...>::allocate_dispatch_table(int size) {
-  using namespace std;
-  delete [] dispatch_table;
-  dispatch_table = new method_pointer_type[size];
-  return reinterpret_cast<void_function_pointer*>(dispatch_table);
+template<class M>
+void method_implementation<R, P...>::remove_spec() {
+  auto entry = std::find_if(methods.begin(), methods.end(), [](specialization_base* method) {
+      return static_cast<method_entry*>(method)->pn == &M::next;
+    });
+
+  if (entry != methods.end()) {
+    method_base::remove_spec(*entry);
+  }
+}
+
+#ifdef YOMM11_COMPACT_DISPATCH
+
+template<typename R, typename... P>
+method_base::dispatch_cell* method_implementation<R, P...>::allocate_dispatch_table(int size) {
+  method_pointer_type* new_targets = new method_pointer_type[targets_size()];
+  new_targets[0] = throw_undefined<signature>::body;
+  new_targets[1] = throw_ambiguous<signature>::body;
+
+  for (auto method : methods) {
+    new_targets[method->index + 2] = static_cast<const method_entry*>(method)->pm;
+  }
+
+  set_targets(reinterpret_cast<void_function_pointer*>(new_targets));
+  set_dispatch_table(new dispatch_cell[size]);
+
+  return dispatch_table;
+}
+
+template<typename R, typename... P>
+method_base::dispatch_cell* method_implementation<R, P...>::get_dispatch_table() const {
+  return dispatch_table;
+}
+
+template<typename R, typename... P>
+void method_implementation<R, P...>::set_dispatch_table(dispatch_cell* table) {
+  retire_array(dispatch_table);
+  dispatch_table = table;
+}
+
+template<typename R, typename... P>
+method_base::void_function_pointer* method_implementation<R, P...>::get_targets() const {
+  return reinterpret_cast<void_function_pointer*>(targets);
+}
+
+template<typename R, typename... P>
+void method_implementation<R, P...>::set_targets(void_function_pointer* new_targets) {
+  retire_array(targets);
+  targets = reinterpret_cast<method_pointer_type*>(new_targets);
 }
 
 template<typename R, typename... P>
 void method_implementation<R, P...>::emit(specialization_base* method, int i) {
-  dispatch_table[i] =
+  store_release(
+      dispatch_table[i],
+      method == &specialization_base::undefined ? 0
+      : method == &specialization_base::ambiguous ? 1
+      : method->index + 2);
+}
+
+#else
+
+template<typename R, typename... P>
+method_base::dispatch_cell* method_implementation<R, P...>::allocate_dispatch_table(int size) {
+  set_dispatch_table(reinterpret_cast<dispatch_cell*>(new method_pointer_type[size]));
+  return reinterpret_cast<dispatch_cell*>(dispatch_table);
+}
+
+template<typename R, typename... P>
+method_base::dispatch_cell* method_implementation<R, P...>::get_dispatch_table() const {
+  return reinterpret_cast<dispatch_cell*>(dispatch_table);
+}
+
+template<typename R, typename... P>
+void method_implementation<R, P...>::set_dispatch_table(dispatch_cell* table) {
+  retire_array(dispatch_table);
+  dispatch_table = reinterpret_cast<method_pointer_type*>(table);
+}
+
+template<typename R, typename... P>
+void method_implementation<R, P...>::emit(specialization_base* method, int i) {
+  store_release(
+      dispatch_table[i],
       method == &specialization_base::ambiguous ? throw_ambiguous<signature>::body
       : method == &specialization_base::undefined ? throw_undefined<signature>::body
-      : static_cast<const method_entry*>(method)->pm;
-  using namespace std;
-  YOMM11_TRACE(cout << "installed at " << dispatch_table << " + " << i << endl);
+      : static_cast<const method_entry*>(method)->pm);
 }
 
+#endif
+
 template<typename R, typename... P>
 void method_implementation<R, P...>::emit_next(specialization_base* method, specialization_base* next) {
-  *static_cast<const method_entry*>(method)->pn =
+  static_cast<const method_entry*>(method)->store_next(
       (next == &specialization_base::ambiguous || next == &specialization_base::undefined) ? nullptr
-      : static_cast<const method_entry*>(next)->pm;
+      : static_cast<const method_entry*>(next)->pm);
 }
 
-template<int Dim, typename... P>
-struct linear;
-
-template<typename P1, typename... P>
-struct linear<0, P1, P...> {
-  template<typename A1, typename... A>
-  static method_base::void_function_pointer* value(
-      std::vector<int>::const_iterator slot_iter,
-      std::vector<int>::const_iterator step_iter,
-      A1, A... args) {
-    return linear<0, P...>::value(slot_iter, step_iter, args...);
+// The part of the index of the cell that depends on the argument for a
+// parameter: nothing for a non-virtual parameter. 'slot_and_step'
+// points to the slot and the step of the dimension.
+template<typename P>
+struct dimension {
+  template<typename A>
+  static int index(const int* slot_and_step, A arg) {
+    return 0;
   }
+#ifndef YOMM11_COMPACT_DISPATCH
+  template<typename A>
+  static method_base::void_function_pointer* address(const int* slot_and_step, A arg) {
+    return nullptr;
+  }
+#endif
 };
 
-template<typename P1, typename... P>
-struct linear<0, virtual_<P1>&, P...> {
-  template<typename A1, typename... A>
-  static method_base::void_function_pointer* value(
-      std::vector<int>::const_iterator slot_iter,
-      std::vector<int>::const_iterator step_iter,
-      A1 arg, A... args) {
-    return linear<1, P...>::value(
-        slot_iter + 1, step_iter + 1,
-        detail::get_mm_table<std::is_base_of<selector, P1>::value>::value(arg)[*slot_iter].ptr, args...);
+template<typename P>
+struct dimension<virtual_<P>&> {
+  template<typename A>
+  static const yomm11_class::offset& entry(const int* slot_and_step, A arg) {
+    return detail::get_mm_table<std::is_base_of<selector, P>::value>::value(arg)[slot_and_step[0]];
   }
+  template<typename A>
+  static int index(const int* slot_and_step, A arg) {
+    return entry(slot_and_step, arg).index * slot_and_step[1];
+  }
+#ifndef YOMM11_COMPACT_DISPATCH
+  // the first dimension holds the address of its row
+  template<typename A>
+  static method_base::void_function_pointer* address(const int* slot_and_step, A arg) {
+    return entry(slot_and_step, arg).ptr;
+  }
+#endif
 };
 
-template<typename P1, typename... P>
-struct linear<0, const virtual_<P1>&, P...> {
-  template<typename A1, typename... A>
-  static method_base::void_function_pointer* value(
-      std::vector<int>::const_iterator slot_iter,
-      std::vector<int>::const_iterator step_iter,
-      A1 arg, A... args) {
-    return linear<1, P...>::value(
-        slot_iter + 1, step_iter + 1,
-        detail::get_mm_table<std::is_base_of<selector, P1>::value>::value(arg)[*slot_iter].ptr, args...);
-  }
+template<typename P>
+struct dimension<const virtual_<P>&> : dimension<virtual_<P>&> {
 };
 
-template<int Dim, typename P1, typename... P>
-struct linear<Dim, P1, P...> {
-  template<typename A1, typename... A>
-  static method_base::void_function_pointer* value(
-      std::vector<int>::const_iterator slot_iter,
-      std::vector<int>::const_iterator step_iter,
-      method_base::void_function_pointer* ptr,
-      A1, A... args) {
-    return linear<Dim, P...>::value(slot_iter, step_iter, ptr, args...);
+#ifdef YOMM11_COMPACT_DISPATCH
+
+// Computes the index of the cell in the dispatch table.
+template<typename... P>
+struct linear {
+  template<typename... A>
+  static int value(const int* slots_and_steps, A... args) {
+    return sum(make_index_sequence<sizeof...(P)>(), slots_and_steps, args...);
   }
-};
 
-template<int Dim, typename P1, typename... P>
-struct linear<Dim, virtual_<P1>&, P...> {
-  template<typename A1, typename... A>
-  static method_base::void_function_pointer* value(
-      std::vector<int>::const_iterator slot_iter,
-      std::vector<int>::const_iterator step_iter,
-      method_base::void_function_pointer* ptr,
-      A1 arg, A... args) {
-    YOMM11_TRACE(std::cout << " -> " << ptr);
-    return linear<Dim + 1, P...>::value(
-        slot_iter + 1, step_iter + 1,
-        ptr + detail::get_mm_table<std::is_base_of<selector, P1>::value>::value(arg)[*slot_iter].index * *step_iter,
-        args...);
+  template<std::size_t... I, typename... A>
+  static int sum(index_sequence<I...>, const int* slots_and_steps, A... args) {
+    int cell = 0;
+    const int expand[] = {
+      0, (cell += dimension<P>::index(slots_and_steps + 2 * virtuals_before<P...>(I), args), 0)...
+    };
+    (void) expand;
+    return cell;
   }
 };
 
-template<int Dim, typename P1, typename... P>
-struct linear<Dim, const virtual_<P1>&, P...> {
-  template<typename A1, typename... A>
-  static method_base::void_function_pointer* value(
-      std::vector<int>::const_iterator slot_iter,
-      std::vector<int>::const_iterator step_iter,
-      method_base::void_function_pointer* ptr,
-      A1 arg, A... args) {
-    YOMM11_TRACE(std::cout << " -> " << ptr);
-    return linear<Dim + 1, P...>::value(
-        slot_iter + 1, step_iter + 1,
-        ptr + detail::get_mm_table<std::is_base_of<selector, P1>::value>::value(arg)[*slot_iter].index * *step_iter,
-        args...);
+#else
+
+// Computes the address of the cell in the dispatch table.
+template<typename... P>
+struct linear {
+  template<typename... A>
+  static method_base::void_function_pointer* value(const int* slots_and_steps, A... args) {
+    return sum(make_index_sequence<sizeof...(P)>(), slots_and_steps, args...);
   }
-};
 
-template<int Dim>
-struct linear<Dim> {
-  static method_base::void_function_pointer* value(
-      std::vector<int>::const_iterator slot_iter,
-      std::vector<int>::const_iterator step_iter,
-      method_base::void_function_pointer* ptr) {
-    YOMM11_TRACE(std::cout << " -> " << ptr << std::endl);
-    return ptr;
+  template<std::size_t... I, typename... A>
+  static method_base::void_function_pointer* sum(
+      index_sequence<I...>, const int* slots_and_steps, A... args) {
+    method_base::void_function_pointer* row = nullptr;
+    int cell = 0;
+    const int expand[] = {
+      0, (virtual_parameter<P>::value && virtuals_before<P...>(I) == 0
+          ? (row = dimension<P>::address(slots_and_steps, args), 0)
+          : (cell += dimension<P>::index(slots_and_steps + 2 * virtuals_before<P...>(I), args), 0))...
+    };
+    (void) expand;
+    return row + cell;
   }
 };
 
-#ifdef YOMM11_TRACE
-
-template<typename C1, typename C2, typename... CN>
-void write(std::ostream& os, virtuals<C1, C2, CN...>) {
-  os << typeid(C1).name() << ", ";
-  write(os, virtuals<C2, CN...>());
-}
+#endif
 
-template<typename C>
-void write(std::ostream& os, virtuals<C>) {
-  os << typeid(C).name();
+template<class Class, class... Bases>
+yomm11_class::initializer<Class, type_list<Bases...>>::initializer() : registration(process) {
+  static_assert(
+      detail::check_bases<Class, type_list<Bases...>>::value,
+      "Error in YOMM11_CLASS(): not a base in base list");
+  // sets 'pc', which objects created before initialize() need
+  yomm11_class& pc = yomm11_class::of<Class>::the();
+  std::lock_guard<std::mutex> lock(registration::mutex);
+  pc.registered = this;
 }
 
-inline void write(std::ostream& os, virtuals<>) {
+template<class Class, class... Bases>
+yomm11_class::initializer<Class, type_list<Bases...>>::initializer(const char* name) : initializer() {
+  yomm11_class::of<Class>::pc->name = name;
 }
 
-template<typename... Class>
-std::ostream& operator <<(std::ostream& os, virtuals<Class...> v){
-  os << "virtuals<";
-  write(os, v);
-  return os << ">";
+template<class Class, class... Bases>
+yomm11_class::initializer<Class, type_list<Bases...>>::~initializer() {
+  std::lock_guard<std::recursive_mutex> registry_lock(registry_mutex());
+  std::lock_guard<std::mutex> lock(registration::mutex);
+  if (yomm11_class::of<Class>::pc->registered == this) {
+    yomm11_class::of<Class>::pc->registered = nullptr;
+  }
 }
-#endif
 
 template<class Class, class... Bases>
-yomm11_class::initializer<Class, type_list<Bases...>>::initializer() {
-  static_assert(
-      detail::check_bases<Class, type_list<Bases...>>::value,
-      "Error in YOMM11_CLASS(): not a base in base list");
+void yomm11_class::initializer<Class, type_list<Bases...>>::process() {
   yomm11_class& pc = yomm11_class::of<Class>::the();
   pc.abstract = std::is_abstract<Class>::value;
-  pc.initialize(detail::yomm11_class_vector_of<Bases...>::get());
+
+  if (!pc.initialize(detail::yomm11_class_vector_of<Bases...>::get())) {
+    // a base is still being registered, by a thread that is loading a
+    // shared object: try again at the next initialize()
+    std::lock_guard<std::mutex> lock(registration::mutex);
+    pc.registered = &the;
+    the.link();
+    return;
+  }
 
   if (!std::is_base_of<selector, Class>::value) {
-    if (!detail::get_mm_table<false>::class_of) {
-      detail::get_mm_table<false>::class_of = new detail::get_mm_table<false>::class_of_type;
-    }
-    (*detail::get_mm_table<false>::class_of)[std::type_index(typeid(Class))] = &pc.mmt;
+    detail::get_mm_table<false>::add(std::type_index(typeid(Class)), &pc.mmt);
   }
 }
 
@@ -882,13 +1491,16 @@ struct method<Method, R(P...)> {
 
   using return_type = R;
   using method_pointer_type = return_type (*)(typename detail::remove_virtual<P>::type...);
+
+  // the specialization that a call with these arguments runs
+  static method_pointer_type target(typename detail::remove_virtual<P>::type... args);
   using method_entry = detail::method_impl<method_pointer_type>;
   using signature = R(typename detail::remove_virtual<P>::type...);
   using virtuals = typename detail::extract_virtuals<P...>::type;
 
   template<typename Tag>
   struct next_ptr {
-    static method_pointer_type next;
+    static std::atomic<method_pointer_type> next;
   };
 
   method_pointer_type next_ptr_type() const;
@@ -897,24 +1509,71 @@ struct method<Method, R(P...)> {
   static implementation& the();
   static implementation* impl;
 
+  // false if a class is still being registered
   template<class Spec>
   static bool specialize() {
-    the().template add_spec<Spec>();
-    return true;
+    std::lock_guard<std::recursive_mutex> lock(registry_mutex());
+    return the().buried || the().template add_spec<Spec>() != nullptr;
+  }
+
+  // called when the specialization is unloaded
+  template<class Spec>
+  static void unspecialize() {
+    std::lock_guard<std::recursive_mutex> lock(registry_mutex());
+    if (impl) {
+      impl->template remove_spec<Spec>();
+    }
+  }
+
+  // Replaces the body of specialization Spec with Replacement::body,
+  // which has the same signature, without re-computing the dispatch
+  // table. Returns the indexes of the cells that lead to the new body.
+  template<class Spec, class Replacement>
+  static std::vector<int> replace() {
+    std::lock_guard<std::recursive_mutex> lock(registry_mutex());
+
+    if (is_frozen()) {
+      throw std::runtime_error("methods: dispatch data is frozen");
+    }
+
+    return the().template replace_spec<Spec, Replacement>();
+  }
+
+  // Adds specialization Spec without re-computing the dispatch table.
+  // Only the cells of the classes that conform to its arguments are
+  // rewritten, which requires that they make up whole groups - see
+  // write_dispatch_report(). Returns the indexes of the cells that
+  // changed.
+  template<class Spec>
+  static std::vector<int> insert() {
+    std::lock_guard<std::recursive_mutex> lock(registry_mutex());
+
+    if (is_frozen()) {
+      throw std::runtime_error("methods: dispatch data is frozen");
+    }
+
+    return the().template insert_spec<Spec>();
   }
 
   template<class Spec>
   struct specialization {
-    static method_pointer_type next;
+    static std::atomic<method_pointer_type> next;
     // this doesn't work on clang, must do it in YOMM11_SPECIALIZATION
     // virtual void* _yomm11_install() { return &register_spec<Spec>::the; }
   };
 };
 
 template<class Method, class Spec>
-struct register_spec {
-  register_spec() {
-    Method::template specialize<Spec>();
+struct register_spec : registration {
+  register_spec() : registration(process) {
+  }
+  ~register_spec() {
+    Method::template unspecialize<Spec>();
+  }
+  static void process() {
+    if (!Method::template specialize<Spec>()) {
+      the.defer();
+    }
   }
   static register_spec the;
 };
@@ -924,7 +1583,7 @@ register_spec<Method, Spec> register_spec<Method, Spec>::the;
 
 template<template<typename Sig> class Method, typename R, typename... P>
 template<class Spec>
-typename method<Method, R(P...)>::method_pointer_type
+std::atomic<typename method<Method, R(P...)>::method_pointer_type>
 method<Method, R(P...)>::specialization<Spec>::next;
 
 template<template<typename Sig> class Method, typename R, typename... P>
@@ -932,12 +1591,12 @@ typename method<Method, R(P...)>::implementation* method<Method, R(P...)>::impl;
 
 template<template<typename Sig> class Method, typename R, typename... P>
 template<typename Tag>
-typename method<Method, R(P...)>::method_pointer_type method<Method, R(P...)>::next_ptr<Tag>::next;
+std::atomic<typename method<Method, R(P...)>::method_pointer_type> method<Method, R(P...)>::next_ptr<Tag>::next;
 
 template<template<typename Sig> class Method, typename R, typename... P>
 typename method<Method, R(P...)>::implementation& method<Method, R(P...)>::the() {
   if (!impl) {
-    impl = new implementation(YOMM11_TRACE(_yomm11_name_((method<Method, R(P...)>*) nullptr)));
+    impl = new implementation(_yomm11_name_((method<Method, R(P...)>*) nullptr));
   }
 
   return *impl;
@@ -945,18 +1604,127 @@ typename method<Method, R(P...)>::implementation& method<Method, R(P...)>::the()
 
 template<template<typename Sig> class Method, typename R, typename... P>
 inline R method<Method, R(P...)>::operator ()(typename detail::remove_virtual<P>::type... args) const {
-  YOMM11_TRACE((std::cout << "() mm table = " << impl->dispatch_table << std::flush));
-  return reinterpret_cast<method_pointer_type>(*detail::linear<0, P...>::value(impl->slots.begin(), impl->steps.begin(), &args...))(args...);
+  return target(args...)(args...);
 }
 
 template<template<typename Sig> class Method, typename R, typename... P>
 inline R method<Method, R(P...)>::resolve(typename detail::remove_virtual<P>::type... args) {
-  YOMM11_TRACE((std::cout << "() mm table = " << impl->dispatch_table << std::flush));
-  return reinterpret_cast<method_pointer_type>(*detail::linear<0, P...>::value(impl->slots.begin(), impl->steps.begin(), &args...))(args...);
+  return target(args...)(args...);
 }
 
+template<template<typename Sig> class Method, typename R, typename... P>
+inline typename method<Method, R(P...)>::method_pointer_type
+method<Method, R(P...)>::target(typename detail::remove_virtual<P>::type... args) {
+  auto header = impl->dispatch_header();
+#ifdef YOMM11_COMPACT_DISPATCH
+  auto cell = detail::linear<P...>::value(header->slots_and_steps(), &args...);
+#ifdef YOMM11_ENABLE_PROFILE
+  detail::profile::count(impl, cell);
+#endif
+  return detail::load_acquire(
+      reinterpret_cast<method_pointer_type*>(header->targets)[detail::load_acquire(header->table[cell])]);
+#else
+  auto cell = detail::linear<P...>::value(header->slots_and_steps(), &args...);
+#ifdef YOMM11_ENABLE_PROFILE
+  detail::profile::count(impl, cell - header->table);
+#endif
+  return reinterpret_cast<method_pointer_type>(detail::load_acquire(*cell));
+#endif
+}
+
+// Runs tasks on a set of threads - the calling thread and up to
+// set_parallel_threads() - 1 helpers, kept in a pool between runs.
+// Each thread takes tasks from the back of its own deque; when it is
+// empty, it steals from the front of the deques of the other threads,
+// or waits for a task to be spawned. Returns when all the tasks, and
+// the tasks that they spawned, have run; rethrows the first exception
+// thrown by a task, after which the remaining tasks are skipped.
+struct work_stealing {
+  using task = std::function<void()>;
+  // objects per chunk: small enough to stay in cache between the passes
+  static const std::size_t chunk_size = 4096;
+  // runs of objects at least this long become tasks of their own
+  static const std::size_t min_task = 512;
+
+  static void run(std::vector<task>& tasks);
+  // from a task: adds a task to the deque of the calling thread
+  static void spawn(task t);
+  static int threads();
+  // Groups the indexes 0..targets.size() - 1 by target. On return,
+  // run r is order[starts[r]] to order[starts[r + 1]], in increasing
+  // order.
+  static void bucket(
+      const std::vector<method_base::void_function_pointer>& targets,
+      std::vector<std::uint32_t>& order, std::vector<std::uint32_t>& starts);
+  static int requested;
+};
+
 } // detail
 
+// Calls method(*p, args...) for each pointer p - raw or smart - in
+// range, in no particular order, on several threads. The range is cut
+// into chunks; the objects of a chunk are grouped by the
+// specialization that they dispatch to, and each group is run through
+// its specialization directly. Large groups become tasks of their own.
+template<template<typename Sig> class Method, typename R, typename... P, class Range, class... Args>
+void parallel_for_each(const detail::method<Method, R(P...)>&, const Range& range, Args&&... args) {
+  using method_type = detail::method<Method, R(P...)>;
+  using method_pointer_type = typename method_type::method_pointer_type;
+  using void_function_pointer = detail::method_base::void_function_pointer;
+  using iterator = decltype(std::begin(range));
+  using work_stealing = detail::work_stealing;
+
+  struct chunk {
+    std::vector<iterator> objects;
+    std::vector<void_function_pointer> targets;
+    std::vector<std::uint32_t> order, starts;
+  };
+
+  std::vector<work_stealing::task> chunks;
+  std::size_t remaining = std::distance(std::begin(range), std::end(range));
+
+  for (iterator first = std::begin(range); remaining; ) {
+    const std::size_t size = std::min(work_stealing::chunk_size, remaining);
+    iterator last = first;
+    std::advance(last, size);
+    remaining -= size;
+
+    chunks.push_back([=, &args...]() {
+        auto c = std::make_shared<chunk>();
+        c->objects.reserve(work_stealing::chunk_size);
+        c->targets.reserve(work_stealing::chunk_size);
+
+        for (iterator iter = first; iter != last; ++iter) {
+          c->objects.push_back(iter);
+          c->targets.push_back(reinterpret_cast<void_function_pointer>(method_type::target(**iter, args...)));
+        }
+
+        work_stealing::bucket(c->targets, c->order, c->starts);
+
+        for (std::size_t r = 0; r + 1 < c->starts.size(); r++) {
+          auto calls = [=, &args...]() {
+            const std::uint32_t* from = &c->order[c->starts[r]];
+            const std::uint32_t* to = &c->order[0] + c->starts[r + 1];
+            auto body = reinterpret_cast<method_pointer_type>(c->targets[*from]);
+            for (; from != to; ++from) {
+              body(**c->objects[*from], args...);
+            }
+          };
+
+          if (c->starts[r + 1] - c->starts[r] >= work_stealing::min_task) {
+            work_stealing::spawn(calls);
+          } else {
+            calls();
+          }
+        }
+      });
+
+    first = last;
+  }
+
+  work_stealing::run(chunks);
+}
+
 template<class B, class D>
 struct cast : cast_best<B, D, detail::is_virtual_base_of<B, D>::value> {
 };
@@ -969,11 +1737,11 @@ struct cast<B, B> {
 
 struct selector {
   selector() : _yomm11_ptbl(0) { }
-  std::vector<detail::yomm11_class::offset>* _yomm11_ptbl;
+  const detail::yomm11_class::mm_table* _yomm11_ptbl;
   virtual ~selector() { }
   template<class THIS>
   void _init_yomm11_ptr(THIS*);
-  std::vector<detail::yomm11_class::offset>* _get_yomm11_ptbl() const { return _yomm11_ptbl; }
+  const detail::yomm11_class::mm_table* _get_yomm11_ptbl() const { return _yomm11_ptbl; }
 };
 
 template<class THIS>
@@ -986,6 +1754,83 @@ struct virtual_ {
   using type = Class;
 };
 
+// Memory used by one method, as of the last call to initialize().
+struct method_statistics {
+  const char* name;
+  const detail::method_base* method;
+  int dimensions;
+  int specializations;
+  std::size_t cells;
+  std::size_t undefined_cells;
+  std::size_t ambiguous_cells;
+  std::size_t bytes;
+  // per dimension: the groups of classes that select the same
+  // specializations, and the rows - the cells of a group - identical
+  // to the row of a group before it
+  std::vector<int> groups;
+  std::vector<int> duplicate_rows;
+
+  double undefined_ratio() const { return cells ? double(undefined_cells) / cells : 0; }
+  double ambiguous_ratio() const { return cells ? double(ambiguous_cells) / cells : 0; }
+  // the cells that lead to a specialization
+  double fill_ratio() const { return cells ? double(cells - undefined_cells - ambiguous_cells) / cells : 0; }
+};
+
+// Bytes used by the library, by category. Hash containers are
+// estimated from their size and bucket count.
+struct memory_statistics {
+  std::size_t mmt;
+  std::size_t dispatch_tables;
+  std::size_t masks;
+  std::size_t specializations;
+  std::size_t foreign_classes;
+  std::size_t to_initialize;
+  std::vector<method_statistics> methods;
+
+  std::size_t total() const {
+    return mmt + dispatch_tables + masks + specializations + foreign_classes + to_initialize;
+  }
+};
+
+// Writes the statistics of the dispatch table of each method as JSON.
+// Setting YOMM11_DISPATCH_REPORT in the environment writes the report
+// to stderr - or to the file it names - at the end of each
+// initialize() that rebuilt tables.
+void write_dispatch_report(std::ostream& os);
+
+// A step of initialize(), reported to the trace sink - see
+// set_trace_sink().
+struct trace_event {
+  enum type {
+    initialize_begin,
+    class_registered, // classes: the class, then its bases
+    slot_assigned,    // arg, index: slot, classes: where the method is rooted
+    group_created,    // arg: dimension, index: group, classes: members
+    cell_emitted,     // index: cell, specialization
+    next_assigned,    // specialization, next
+    initialize_end
+  };
+
+  type kind;
+  const char* method = nullptr;
+  int arg = -1;
+  int index = -1;
+  bool shared = false; // slot_assigned: shared with other methods
+  std::vector<const char*> classes;
+  // e.g. "(Wolf, Animal)", "undefined" or "ambiguous"
+  std::string specialization, next;
+
+  static const char* name(type kind);
+};
+
+using trace_sink = std::function<void(const trace_event&)>;
+
+// Sends the steps of initialize() to sink; an empty function disables
+// tracing. Setting YOMM11_TRACE in the environment writes them to
+// stderr - or to the file it names - as JSON lines.
+void set_trace_sink(trace_sink sink);
+void write_json(std::ostream& os, const trace_event& event);
+
 } // methods
   namespace multi_methods = methods;
 } // yorel
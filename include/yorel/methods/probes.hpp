@@ -0,0 +1,107 @@
+#ifndef YOMM11_PROBES_INCLUDED
+#define YOMM11_PROBES_INCLUDED
+
+// method/probes.hpp
+// Copyright (c) 2013 Jean-Louis Leroy
+// Distributed under the Boost Software License, Version 1.0. (See
+// accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+// YOMM11_ENABLE_PROBES places SystemTap-compatible static probes -
+// usable from perf, bpftrace, stap or gdb - in the library, provider
+// 'yomm11':
+//
+//   initialize__begin()
+//   initialize__end(int methods)
+//   hierarchy__begin(const char* root)
+//   hierarchy__end(const char* root, int classes)
+//   resolve__begin(const char* method)
+//   resolve__end(const char* method, int undefined_cells, int ambiguous_cells)
+//   undefined(const char* signature)
+//   ambiguous(const char* signature)
+//
+// The last two fire in the error thunks, which are instantiated in the
+// client, so the client must be compiled with the macro too. A probe
+// is a nop and a note in the ELF file; there is no semaphore, so the
+// arguments are computed even when no tracer is attached - they are
+// all cheap. The notes are written in the format of <sys/sdt.h>, which
+// is not needed at build time. Elsewhere than on Linux x86-64 and
+// AArch64, the probes expand to nothing.
+//#define YOMM11_ENABLE_PROBES
+
+#if defined(YOMM11_ENABLE_PROBES) && defined(__linux__) && defined(__GNUC__) \
+  && (defined(__x86_64__) || defined(__aarch64__))
+
+#include <type_traits>
+
+namespace yorel {
+namespace methods {
+namespace detail {
+
+// size of a probe argument, negative if signed, as in <sys/sdt.h>
+template<typename T>
+struct probe_arg {
+  using type = typename std::decay<T>::type;
+  static constexpr int size = std::is_signed<type>::value ? -int(sizeof(type)) : int(sizeof(type));
+};
+
+}
+}
+}
+
+#define YOMM11_PROBE_ASM(NAME, ARGS)                                    \
+  "990: nop\n"                                                          \
+  ".pushsection .note.stapsdt,\"?\",\"note\"\n"                         \
+  ".balign 4\n"                                                         \
+  ".4byte 992f-991f, 994f-993f, 3\n"                                    \
+  "991: .asciz \"stapsdt\"\n"                                           \
+  "992: .balign 4\n"                                                    \
+  "993: .8byte 990b\n"                                                  \
+  ".8byte _.stapsdt.base\n"                                             \
+  ".8byte 0\n"                                                          \
+  ".asciz \"yomm11\"\n"                                                 \
+  ".asciz \"" #NAME "\"\n"                                              \
+  ".asciz \"" ARGS "\"\n"                                               \
+  "994: .balign 4\n"                                                    \
+  ".popsection\n"                                                       \
+  ".ifndef _.stapsdt.base\n"                                            \
+  ".pushsection .stapsdt.base,\"aG\",\"progbits\",.stapsdt.base,comdat\n" \
+  ".weak _.stapsdt.base\n"                                              \
+  ".hidden _.stapsdt.base\n"                                            \
+  "_.stapsdt.base: .space 1\n"                                          \
+  ".size _.stapsdt.base, 1\n"                                           \
+  ".popsection\n"                                                       \
+  ".endif\n"
+
+#define YOMM11_PROBE_OPERAND(N, ARG)                                    \
+  [s ## N] "n" (::yorel::methods::detail::probe_arg<decltype(ARG)>::size), \
+  [a ## N] "nor" (ARG)
+
+#define YOMM11_PROBE0(NAME)                                             \
+  __asm__ __volatile__(YOMM11_PROBE_ASM(NAME, ""))
+
+#define YOMM11_PROBE1(NAME, A1)                                         \
+  __asm__ __volatile__(YOMM11_PROBE_ASM(NAME, "%c[s1]@%[a1]")          \
+                       :: YOMM11_PROBE_OPERAND(1, A1))
+
+#define YOMM11_PROBE2(NAME, A1, A2)                                     \
+  __asm__ __volatile__(YOMM11_PROBE_ASM(NAME, "%c[s1]@%[a1] %c[s2]@%[a2]") \
+                       :: YOMM11_PROBE_OPERAND(1, A1),                  \
+                       YOMM11_PROBE_OPERAND(2, A2))
+
+#define YOMM11_PROBE3(NAME, A1, A2, A3)                                 \
+  __asm__ __volatile__(YOMM11_PROBE_ASM(NAME, "%c[s1]@%[a1] %c[s2]@%[a2] %c[s3]@%[a3]") \
+                       :: YOMM11_PROBE_OPERAND(1, A1),                  \
+                       YOMM11_PROBE_OPERAND(2, A2),                     \
+                       YOMM11_PROBE_OPERAND(3, A3))
+
+#else
+
+#define YOMM11_PROBE0(NAME)
+#define YOMM11_PROBE1(NAME, A1)
+#define YOMM11_PROBE2(NAME, A1, A2)
+#define YOMM11_PROBE3(NAME, A1, A2, A3)
+
+#endif
+
+#endif
@@ -7,29 +7,52 @@
 // accompanying file LICENSE_1_0.txt or copy at
 // http://www.boost.org/LICENSE_1_0.txt)
 
+#include <mutex>
+
 namespace yorel {
 namespace methods {
 namespace detail {
 
+// Tracing costs one test of 'enabled' when disabled: the events are
+// built only when it is set.
+struct trace {
+  static bool enabled;
+  static trace_sink sink;
+  static void emit(const trace_event& event);
+  // reads YOMM11_TRACE once
+  static void from_environment();
+};
+
 struct hierarchy_initializer {
   hierarchy_initializer(yomm11_class& root);
 
   void collect_classes();
   void make_masks();
+  void reserve_live_columns(std::vector<bitvec>& slots);
   void assign_slots();
   void execute();
 
-  static void initialize(yomm11_class& root);
+  static void initialize(yomm11_class& root, bool keep_live_columns = false);
 
   void topological_sort_visit(std::unordered_set<const yomm11_class*>& once, yomm11_class* pc);
 
   yomm11_class& root;
   std::vector<yomm11_class*> nodes;
+  // Set when other threads may be dispatching: the slots that published
+  // headers - and retired ones - refer to are left alone, and rows
+  // never shrink.
+  bool keep_live_columns;
 };
 
 struct grouping_resolver {
   grouping_resolver(method_base& mm);
 
+  struct group {
+    bitvec mask;
+    std::vector<specialization_base*> methods;
+    std::vector<yomm11_class*> classes;
+  };
+
   void resolve();
   void resolve(int dim, const bitvec& candidates);
   void find_applicable(int dim, const yomm11_class* pc, std::vector<specialization_base*>& best);
@@ -37,21 +60,106 @@ struct grouping_resolver {
   specialization_base* find_best(const std::vector<specialization_base*>& methods);
   void make_mask(const std::vector<specialization_base*>& best, bitvec& mask);
   void make_groups();
+  void make_groups(int dim, std::vector<group>& dim_groups);
+  std::vector<int> numbering(int dim);
   void make_table();
   void assign_next();
 
-  struct group {
-    bitvec mask;
-    std::vector<specialization_base*> methods;
-    std::vector<yomm11_class*> classes;
-  };
-
   method_base& mm;
   const int dims;
   std::vector<std::vector<group>> groups;
-  method_base::void_function_pointer* dispatch_table;
+  method_base::dispatch_cell* dispatch_table;
   int emit_at;
 };
+
+// Packs the mm tables of all classes, then the dispatch tables and the
+// slots and steps of all methods, into a single block of memory, the
+// dispatch arena. Classes are laid out hierarchy by hierarchy, so the
+// rows of related classes are adjacent; identical rows are stored
+// once. Tables start on a cache line.
+struct arena_builder {
+  static const std::size_t cache_line = 64;
+
+  void collect_classes();
+  void layout();
+  void copy();
+  void relocate(char* replica);
+  void execute();
+
+  static void initialize();
+  static char* allocate(std::size_t size, std::size_t& mapped, int node = -1);
+  static void release(char* memory, std::size_t mapped);
+  static int replicas();
+
+  std::vector<yomm11_class*> classes;
+  std::vector<method_base*> methods;
+  std::unordered_map<const yomm11_class*, std::size_t> row_at;
+  std::unordered_map<const method_base*, std::size_t> table_at, targets_at, header_at;
+  std::size_t foreign_at, foreign_size; // frozen copy of the foreign classes
+  std::size_t size;
+  char* memory; // as allocated
+  char* base; // aligned on a cache line
+  std::size_t mapped;
+
+  // the current arena
+  static char* arena_memory;
+  static char* arena_base;
+  static std::size_t arena_size;
+  static std::size_t arena_mapped; // bytes obtained from mmap, 0 if from new
+  static bool huge_pages;
+  // set by freeze(): the arena is mapped on pages of its own, then made
+  // read-only
+  static bool frozen;
+
+  // With YOMM11_NUMA_REPLICAS: the arena is copied on each NUMA node,
+  // and the pointers inside each copy are relocated to the copy. The
+  // arena itself serves node 0.
+  static bool numa;
+  static int numa_nodes; // 0: read from /sys
+  static char* replica_memory[YOMM11_MAX_NUMA_NODES];
+  static std::size_t replica_mapped[YOMM11_MAX_NUMA_NODES];
+};
+
+// Quiescent-state-based reclamation of the dispatch data replaced by
+// initialize(). Threads that dispatch while another thread runs
+// initialize() register, and announce quiescent states from time to
+// time. Memory retired at epoch E is released once every registered
+// thread has announced a quiescent state at a later epoch. Columns of
+// mm tables are retired the same way: their slots are not reused until
+// then.
+struct reclaimer {
+  struct reader {
+    std::atomic<std::uint64_t> seen;
+    reader* next;
+  };
+
+  struct retired_memory {
+    void* p;
+    void (*release)(void*, std::size_t);
+    std::size_t size;
+    std::uint64_t epoch;
+  };
+
+  struct retired_column {
+    yomm11_class* pc;
+    int slot;
+    std::uint64_t epoch;
+  };
+
+  static bool readers_registered();
+  static void retire(void* p, void (*release)(void*, std::size_t), std::size_t size);
+  static void retire_column(yomm11_class* pc, int slot);
+  static void forget(yomm11_class* pc);
+  static void advance();
+  static void reclaim();
+  static std::size_t pending();
+
+  static std::mutex mutex;
+  static reader* readers;
+  static std::atomic<std::uint64_t> epoch;
+  static std::vector<retired_memory>* memory;
+  static std::vector<retired_column>* columns;
+};
 }
 }
 }
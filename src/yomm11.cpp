@@ -11,6 +11,19 @@
 #include <string>
 #include <functional>
 #include <cassert>
+#include <cstring>
+#include <fstream>
+#include <deque>
+#include <set>
+#include <thread>
+#include <condition_variable>
+#include <chrono>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
 
 using namespace std;
 
@@ -32,19 +45,465 @@ ambiguous::ambiguous() :
 
 using class_set = std::unordered_set<const yomm11_class*>;
 
-yomm11_class::yomm11_class(YOMM11_TRACE(const char* name)) : abstract(false), index(-1), root(nullptr) YOMM11_COMMA_TRACE(name(name)) {
+recursive_mutex& detail::registry_mutex() {
+  // never destroyed: classes are unregistered during static destruction
+  static recursive_mutex* mutex = new recursive_mutex;
+  return *mutex;
+}
+
+#ifdef YOMM11_NUMA_REPLICAS
+thread_local int detail::replica;
+#endif
+
+bool trace::enabled;
+trace_sink trace::sink;
+
+void trace::emit(const trace_event& event) {
+  sink(event);
+}
+
+void trace::from_environment() {
+  static bool done;
+
+  if (done) {
+    return;
+  }
+
+  done = true;
+  const char* where = getenv("YOMM11_TRACE");
+
+  if (!where || !*where || !strcmp(where, "0")) {
+    return;
+  }
+
+  ostream* os = &cerr;
+
+  if (strcmp(where, "1") && strcmp(where, "stderr")) {
+    // never closed: initialize() may run during static destruction
+    os = new ofstream(where, ios::app);
+  }
+
+  auto start = make_shared<chrono::steady_clock::time_point>(chrono::steady_clock::now());
+
+  sink = [=](const trace_event& event) {
+    if (event.kind == trace_event::initialize_begin) {
+      *start = chrono::steady_clock::now();
+    }
+    // microseconds since the start of initialize()
+    *os << "{\"us\": " << chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - *start).count()
+        << ", ";
+    write_json(*os, event);
+    *os << "}" << endl;
+  };
+  enabled = true;
+}
+
+namespace {
+
+// where YOMM11_DISPATCH_REPORT sends the report, or null; read once
+ostream* dispatch_report_stream() {
+  static ostream* os = [] () -> ostream* {
+    const char* where = getenv("YOMM11_DISPATCH_REPORT");
+
+    if (!where || !*where || !strcmp(where, "0")) {
+      return nullptr;
+    }
+
+    if (!strcmp(where, "1") || !strcmp(where, "stderr")) {
+      return &cerr;
+    }
+
+    // never closed: initialize() may run during static destruction
+    return new ofstream(where, ios::app);
+  }();
+
+  return os;
+}
+
+trace_event make_event(trace_event::type kind, const char* method = nullptr) {
+  trace_event event;
+  event.kind = kind;
+  event.method = method;
+  return event;
+}
+
+vector<const char*> names(const vector<yomm11_class*>& classes) {
+  vector<const char*> result;
+  for (yomm11_class* pc : classes) {
+    result.push_back(pc->name);
+  }
+  return result;
+}
+
+string describe(const specialization_base* spec) {
+  if (!spec) {
+    return "";
+  }
+
+  if (spec == &specialization_base::undefined) {
+    return "undefined";
+  }
+
+  if (spec == &specialization_base::ambiguous) {
+    return "ambiguous";
+  }
+
+  string result;
+  const char* sep = "(";
+
+  for (yomm11_class* pc : spec->args) {
+    result += sep;
+    result += pc->name ? pc->name : "?";
+    sep = ", ";
+  }
+
+  return result + ")";
+}
+
+void trace_slot(const yomm11_class* pc, const method_base* pm, int arg, int slot, bool shared) {
+  if (trace::enabled) {
+    trace_event event = make_event(trace_event::slot_assigned, pm->name);
+    event.arg = arg;
+    event.index = slot;
+    event.shared = shared;
+    event.classes.push_back(pc->name);
+    trace::emit(event);
+  }
+}
+
+}
+
+const char* trace_event::name(type kind) {
+  static const char* const names[] = {
+    "initialize_begin", "class_registered", "slot_assigned", "group_created",
+    "cell_emitted", "next_assigned", "initialize_end"
+  };
+  return names[kind];
+}
+
+namespace {
+
+void write_json_string(ostream& os, const char* s) {
+  if (!s) {
+    os << "null";
+    return;
+  }
+
+  os << '"';
+  for (; *s; ++s) {
+    if (*s == '"' || *s == '\\') {
+      os << '\\';
+    }
+    os << *s;
+  }
+  os << '"';
+}
+
+}
+
+// Writes the members of the event, without the braces, so sinks can
+// add their own.
+void write_json(ostream& os, const trace_event& event) {
+  os << "\"event\": \"" << trace_event::name(event.kind) << "\"";
+
+  if (event.method) {
+    os << ", \"method\": ";
+    write_json_string(os, event.method);
+  }
+
+  if (event.arg >= 0) {
+    os << ", \"arg\": " << event.arg;
+  }
+
+  if (event.index >= 0) {
+    os << ", \"index\": " << event.index;
+  }
+
+  if (event.shared) {
+    os << ", \"shared\": true";
+  }
+
+  if (!event.classes.empty()) {
+    os << ", \"classes\": [";
+    const char* sep = "";
+    for (const char* name : event.classes) {
+      os << sep;
+      sep = ", ";
+      write_json_string(os, name);
+    }
+    os << "]";
+  }
+
+  if (!event.specialization.empty()) {
+    os << ", \"specialization\": ";
+    write_json_string(os, event.specialization.c_str());
+  }
+
+  if (!event.next.empty()) {
+    os << ", \"next\": ";
+    write_json_string(os, event.next.c_str());
+  }
+}
+
+void set_trace_sink(trace_sink sink) {
+  lock_guard<recursive_mutex> lock(registry_mutex());
+  // the environment does not override the program
+  trace::from_environment();
+  trace::sink = sink;
+  trace::enabled = bool(trace::sink);
+}
+
+registration* registration::first;
+registration* registration::last;
+mutex registration::mutex;
+
+registration::registration(void (*process)()) : process(process), linked(false) {
+  lock_guard<std::mutex> lock(mutex);
+  link();
+}
+
+registration::~registration() {
+  lock_guard<recursive_mutex> registry_lock(registry_mutex());
+  lock_guard<std::mutex> lock(mutex);
+  unlink();
+}
+
+void registration::link() {
+  prev = last;
+  next = nullptr;
+  (last ? last->next : first) = this;
+  last = this;
+  linked = true;
+}
+
+void registration::unlink() {
+  if (linked) {
+    (prev ? prev->next : first) = next;
+    (next ? next->prev : last) = prev;
+    linked = false;
+  }
+}
+
+void registration::defer() {
+  lock_guard<std::mutex> lock(mutex);
+  link();
+}
+
+registration* registration::pop() {
+  lock_guard<std::mutex> lock(mutex);
+  registration* node = first;
+
+  if (node) {
+    node->unlink();
+  }
+
+  return node;
+}
+
+void registration::run_pending() {
+  lock_guard<recursive_mutex> registry_lock(registry_mutex());
+  trace::from_environment();
+
+  // Nodes deferred by process() go back to the end of the list: visit
+  // each node present at the start once.
+  int pending = 0;
+
+  {
+    lock_guard<std::mutex> lock(mutex);
+    for (registration* node = first; node; node = node->next) {
+      ++pending;
+    }
+  }
+
+  while (pending--) {
+    if (registration* node = pop()) {
+      node->process();
+    }
+  }
+
+  get_mm_table<false>::publish();
+}
+
+yomm11_class* yomm11_class::first;
+yomm11_class* yomm11_class::last;
+
+// Classes join the list of live classes when they are initialized:
+// constructing a class descriptor, during static initialization, does
+// not touch shared state.
+yomm11_class::yomm11_class(const char* name) : name(name), index(-1), root(nullptr), abstract(false), registered(nullptr), prev(nullptr), next(nullptr) {
 }
 
 yomm11_class::~yomm11_class() {
+  lock_guard<recursive_mutex> lock(registry_mutex());
+
+  if (!root) {
+    return;
+  }
+
+  // The registered classes derived from this one are being unloaded
+  // too - they come from the same shared object, or from one unloaded
+  // before - but their descriptors may be destroyed later. Detach them
+  // now, so their destructors do not reach this one.
+  vector<yomm11_class*> descendants;
+  unordered_set<const yomm11_class*> once;
+  vector<yomm11_class*> derived(specs);
+
+  while (!derived.empty()) {
+    yomm11_class* pc = derived.back();
+    derived.pop_back();
+
+    if (once.insert(pc).second) {
+      descendants.push_back(pc);
+      derived.insert(derived.end(), pc->specs.begin(), pc->specs.end());
+    }
+  }
+
+  for (yomm11_class* pc : descendants) {
+    pc->unregister();
+
+    // a base in another hierarchy
+    if (pc->root != root) {
+      add_to_initialize(pc->root);
+    }
+
+    pc->specs.clear();
+    pc->root = nullptr;
+  }
+
+  unregister();
+
+  if (is_root()) {
+    // nothing is left of the hierarchy; removing specializations may
+    // have queued it again
+    remove_from_initialize(this);
+    return;
+  }
+
+  if (!descendants.empty()) {
+    add_to_initialize(root);
+    return;
+  }
+
+  // Removing a leaf leaves the slots of the other classes valid: no need
+  // to re-slot the hierarchy. The tables of the methods where the class
+  // had a group of its own have dead cells; re-compute only those.
+  unordered_set<const yomm11_class*> ancestors;
+  vector<yomm11_class*> stack(bases);
+
+  while (!stack.empty()) {
+    yomm11_class* pc = stack.back();
+    stack.pop_back();
+
+    if (!ancestors.insert(pc).second) {
+      continue;
+    }
+
+    stack.insert(stack.end(), pc->bases.begin(), pc->bases.end());
+
+    for (auto& mp : pc->rooted_here) {
+      const int slot = mp.method->slots[mp.arg];
+
+      if (slot >= mmt.size()) {
+        continue;
+      }
+
+      // const: the non-const operator [] makes a draft
+      const offset group = mmt.latest()[slot];
+      bool shared = false;
+      unordered_set<const yomm11_class*> once;
+
+      pc->for_each_conforming(once, [&](yomm11_class* other) {
+          if (!shared && slot < other->mmt.size()) {
+#ifndef YOMM11_COMPACT_DISPATCH
+            if (mp.arg == 0) {
+              shared = other->mmt.latest()[slot].ptr == group.ptr;
+              return;
+            }
+#endif
+            shared = other->mmt.latest()[slot].index == group.index;
+          }
+        });
+
+      if (!shared) {
+        mp.method->invalidate();
+      }
+    }
+  }
+}
+
+void yomm11_class::unregister() {
+  (prev ? prev->next : first) = next;
+  (next ? next->prev : last) = prev;
+
   for (yomm11_class* base : bases) {
-    base->specs.erase(
-        remove_if(base->specs.begin(), base->specs.end(), [=](yomm11_class* pc) {
-            return pc == this;
-          }),
-        base->specs.end());
+    base->specs.erase(remove(base->specs.begin(), base->specs.end(), this), base->specs.end());
   }
 
-  add_to_initialize(root);
+  // the methods that dispatch on the class cannot be called any more:
+  // they were defined with it, or in a shared object unloaded before
+  while (!rooted_here.empty()) {
+    rooted_here.back().method->bury();
+  }
+
+  if (get_mm_table<false>::remove(&mmt)) {
+    get_mm_table<false>::publish();
+  }
+
+  // the next arena will not hold the rows of the class
+  if (mmt.size() && !mmt.draft) {
+    mmt.make_draft();
+  }
+
+  mmt.publish();
+
+  // the specializations that name the class go with it
+  for (method_base* pm = method_base::first; pm; pm = pm->next) {
+    pm->remove_specs_using(this);
+  }
+
+  reclaimer::forget(this);
+}
+
+yomm11_class::mm_table::~mm_table() {
+  delete [] draft;
+  retire_array(entries.load(memory_order_relaxed));
+}
+
+void yomm11_class::mm_table::resize(int size) {
+  offset* new_draft = new offset[size]();
+  offset* from = latest();
+  std::copy(from, from + min(n, size), new_draft);
+  delete [] draft;
+  draft = new_draft;
+  n = size;
+}
+
+void yomm11_class::mm_table::make_draft() {
+  offset* from = entries.load(memory_order_relaxed);
+  draft = new offset[n];
+  std::copy(from, from + n, draft);
+}
+
+void yomm11_class::mm_table::publish() {
+  if (draft) {
+    offset* new_entries = draft;
+    draft = nullptr;
+    publish(new_entries);
+  }
+}
+
+void yomm11_class::mm_table::publish(offset* new_entries) {
+  delete [] draft;
+  draft = nullptr;
+  auto old_entries = entries.exchange(new_entries, memory_order_release);
+
+#ifdef YOMM11_NUMA_REPLICAS
+  for (auto& replica : replicas) {
+    replica.store(new_entries, memory_order_release);
+  }
+#endif
+
+  retire_array(old_entries);
 }
 
 void yomm11_class::for_each_spec(function<void(yomm11_class*)> pf) {
@@ -76,13 +535,55 @@ bool yomm11_class::specializes(const yomm11_class& other) const {
   return index > other.index && other.mask[index];
 }
 
-void yomm11_class::initialize(const vector<yomm11_class*>& b) {
-  YOMM11_TRACE(cout << "initialize class_of<" << name << ">\n");
+bool yomm11_class::make_ready() {
+  if (!root) {
+    registration* pending;
+
+    {
+      lock_guard<mutex> lock(registration::mutex);
+      pending = registered;
+      if (pending) {
+        pending->unlink();
+        registered = nullptr;
+      }
+    }
+
+    if (pending) {
+      pending->process();
+    }
+  }
+
+  return root != nullptr;
+}
 
+bool yomm11_class::initialize(const vector<yomm11_class*>& b) {
   if (root) {
     throw runtime_error("methods: class redefinition");
   }
 
+  if (trace::enabled) {
+    trace_event event = make_event(trace_event::class_registered);
+    event.classes.push_back(name);
+    for (yomm11_class* base : b) {
+      event.classes.push_back(base->name);
+    }
+    trace::emit(event);
+  }
+
+  {
+    lock_guard<mutex> lock(registration::mutex);
+    if (registered) {
+      registered->unlink();
+      registered = nullptr;
+    }
+  }
+
+  for (yomm11_class* base : b) {
+    if (!base->make_ready()) {
+      return false;
+    }
+  }
+
   bases = b;
 
   if (bases.empty()) {
@@ -96,6 +597,10 @@ void yomm11_class::initialize(const vector<yomm11_class*>& b) {
     root = bases[0]->root;
   }
 
+  prev = last;
+  (last ? last->next : first) = this;
+  last = this;
+
   for (yomm11_class* pb : bases) {
     pb->specs.push_back(this);
   }
@@ -107,13 +612,100 @@ void yomm11_class::initialize(const vector<yomm11_class*>& b) {
         mr.method->invalidate();
       }
     });
+
+  return true;
+}
+
+namespace {
+// conforms_to() without the masks, which initialize() computes
+bool derives_from(const yomm11_class* pc, const yomm11_class* other) {
+  return pc == other || any_of(pc->bases.begin(), pc->bases.end(), [=](const yomm11_class* base) {
+      return derives_from(base, other);
+    });
+}
+}
+
+bool yomm11_class::make_provisional_rows() {
+  bool complete = true;
+
+  for (auto pc = first; pc; pc = pc->next) {
+    if (!pc->root || pc->mmt.size()) {
+      continue;
+    }
+
+    vector<offset> row;
+    vector<bool> filled;
+    bool found = true;
+
+    for (auto pm = method_base::first; found && pm; pm = pm->next) {
+      if (!pm->dispatch.load(memory_order_relaxed)) {
+        continue;
+      }
+
+      for (size_t dim = 0; found && dim < pm->vargs.size(); dim++) {
+        if (!derives_from(pc, pm->vargs[dim])) {
+          continue;
+        }
+
+        const int slot = pm->slots[dim];
+        // the specializations that the current table knows of: not the
+        // ones that name a class without a row yet
+        vector<const yomm11_class*> args;
+
+        for (auto spec : pm->methods) {
+          if (all_of(spec->args.begin(), spec->args.end(), [](const yomm11_class* arg) { return arg->mmt.size() != 0; })) {
+            args.push_back(spec->args[dim]);
+          }
+        }
+
+        const yomm11_class* model = nullptr;
+        class_set once;
+
+        pm->vargs[dim]->for_each_conforming(once, [&](yomm11_class* other) {
+            if (!model && other != pc && other->mmt.size() > slot
+                && all_of(args.begin(), args.end(), [&](const yomm11_class* arg) {
+                    return derives_from(pc, arg) == derives_from(other, arg);
+                  })) {
+              model = other;
+            }
+          });
+
+        if (!model) {
+          found = false;
+          break;
+        }
+
+        if (int(row.size()) <= slot) {
+          row.resize(slot + 1);
+          filled.resize(slot + 1);
+        }
+
+        const offset& entry = model->mmt.latest()[slot];
+
+        if (filled[slot] && memcmp(&row[slot], &entry, sizeof(offset))) {
+          found = false;
+        }
+
+        row[slot] = entry;
+        filled[slot] = true;
+      }
+    }
+
+    if (!found) {
+      complete = false;
+    } else if (!row.empty()) {
+      pc->mmt.resize(row.size());
+      copy(row.begin(), row.end(), pc->mmt.draft);
+      pc->mmt.publish();
+    }
+  }
+
+  return complete;
 }
 
 unordered_set<yomm11_class*>* yomm11_class::to_initialize;
 
 void yomm11_class::add_to_initialize(yomm11_class* pc) {
-  YOMM11_TRACE(cout << "add to initialize: " << pc << endl);
-
   if (!to_initialize) {
     to_initialize = new unordered_set<yomm11_class*>;
   }
@@ -122,8 +714,6 @@ void yomm11_class::add_to_initialize(yomm11_class* pc) {
 }
 
 void yomm11_class::remove_from_initialize(yomm11_class* pc) {
-  YOMM11_TRACE(cout << "remove from initialize: " << pc->name << endl);
-
   if (to_initialize) {
     to_initialize->erase(pc);
 
@@ -137,11 +727,12 @@ void yomm11_class::remove_from_initialize(yomm11_class* pc) {
 specialization_base specialization_base::undefined;
 specialization_base specialization_base::ambiguous;
 
-hierarchy_initializer::hierarchy_initializer(yomm11_class& root) : root(root) {
+hierarchy_initializer::hierarchy_initializer(yomm11_class& root) : root(root), keep_live_columns(false) {
 }
 
-void hierarchy_initializer::initialize(yomm11_class& root) {
+void hierarchy_initializer::initialize(yomm11_class& root, bool keep_live_columns) {
   hierarchy_initializer init(root);
+  init.keep_live_columns = keep_live_columns;
   init.execute();
 }
 
@@ -158,10 +749,11 @@ void hierarchy_initializer::topological_sort_visit(std::unordered_set<const yomm
 }
 
 void hierarchy_initializer::execute() {
-  YOMM11_TRACE(cout << "assigning slots for hierarchy rooted in " << &root << endl);
+  YOMM11_PROBE1(hierarchy__begin, root.name);
   collect_classes();
   make_masks();
   assign_slots();
+  YOMM11_PROBE2(hierarchy__end, root.name, int(nodes.size()));
 
   for (auto pc : nodes) {
     if (pc->is_root()) {
@@ -196,13 +788,83 @@ void hierarchy_initializer::make_masks() {
   }
 }
 
+// Can the slot used for this argument be shared with other methods?
+static bool shareable_slot(int arg) {
+#ifdef YOMM11_COMPACT_DISPATCH
+  (void) arg;
+  return true;
+#else
+  // the first argument's entry points inside the method's own table
+  return arg > 0;
+#endif
+}
+
+void hierarchy_initializer::reserve_live_columns(vector<bitvec>& slots) {
+  auto reserve = [&](yomm11_class* pc, int slot) {
+    if (pc->index >= 0 && pc->index < int(nodes.size()) && nodes[pc->index] == pc) {
+      while (int(slots.size()) <= slot) {
+        slots.push_back(bitvec(nodes.size()));
+      }
+      slots[slot] |= pc->mask;
+    }
+  };
+
+  for (method_base* pm = method_base::first; pm; pm = pm->next) {
+    if (auto header = pm->dispatch.load(memory_order_relaxed)) {
+      for (size_t arg = 0; arg < pm->vargs.size(); arg++) {
+        reserve(pm->vargs[arg], header->slots_and_steps()[2 * arg]);
+      }
+    }
+  }
+
+  lock_guard<mutex> lock(reclaimer::mutex);
+
+  if (reclaimer::columns) {
+    for (auto& column : *reclaimer::columns) {
+      reserve(column.pc, column.slot);
+    }
+  }
+}
+
 void hierarchy_initializer::assign_slots() {
   vector<bitvec> slots;
 
+  if (keep_live_columns) {
+    reserve_live_columns(slots);
+  }
+
+  // Methods rooted in the same class, for which the class' conforming
+  // classes fall in the same groups, can use the same slot.
+  struct column {
+    method_base* method;
+    int arg;
+    vector<int> numbering;
+    int slot;
+  };
+
   for (auto pc : nodes) {
     int max_slots = 0;
+    vector<column> columns;
 
     for (auto& mm : pc->rooted_here) {
+      mm.method->shared_slots[mm.arg] = false;
+      vector<int> numbering;
+
+      if (shareable_slot(mm.arg)) {
+        numbering = grouping_resolver(*mm.method).numbering(mm.arg);
+        auto same = find_if(
+            columns.begin(), columns.end(),
+            [&](const column& c) { return c.numbering == numbering; });
+
+        if (same != columns.end()) {
+          trace_slot(pc, mm.method, mm.arg, same->slot, true);
+          same->method->shared_slots[same->arg] = true;
+          mm.method->shared_slots[mm.arg] = true;
+          mm.method->assign_slot(mm.arg, same->slot);
+          continue;
+        }
+      }
+
       auto available_slot = find_if(
           slots.begin(), slots.end(),
           [=](const bitvec& mask) {
@@ -219,9 +881,12 @@ void hierarchy_initializer::assign_slots() {
       int slot = available_slot - slots.begin();
       max_slots = max(max_slots, slot + 1);
 
-      YOMM11_TRACE(cout << "slot " << slot << " -> " << mm.method->vargs
-                     << " (arg " << mm.arg << ")" << endl);
+      trace_slot(pc, mm.method, mm.arg, slot, false);
       mm.method->assign_slot(mm.arg, slot);
+
+      if (shareable_slot(mm.arg)) {
+        columns.push_back(column { mm.method, mm.arg, move(numbering), slot });
+      }
     }
 
     int max_inherited_slots = pc->bases.empty() ? 0
@@ -229,29 +894,369 @@ void hierarchy_initializer::assign_slots() {
                                     pc->bases.begin(), pc->bases.end(),
                                     [](const yomm11_class* b1, const yomm11_class* b2) { return b1->mmt.size() < b2->mmt.size(); }))->mmt.size();
 
-    YOMM11_TRACE(cout << pc << ":max inherited slots: " << max_inherited_slots
-                   << ", max direct slots: " << max_slots << endl);
-    pc->mmt.resize(max(max_inherited_slots, max_slots));
+    int size = max(max_inherited_slots, max_slots);
+
+    if (keep_live_columns) {
+      // the slots in use further right may still be read
+      size = max(size, pc->mmt.size());
+    }
+
+    pc->mmt.resize(size);
   }
 }
 
-void initialize() {
-  while (yomm11_class::to_initialize) {
-    auto pc = *yomm11_class::to_initialize->begin();
-    if (pc->is_root()) {
-      hierarchy_initializer::initialize(*pc);
-    } else {
-      yomm11_class::remove_from_initialize(pc);
+namespace {
+
+// After freeze(), the tables cannot change: refuse the work that would
+// change them.
+void check_not_frozen() {
+  if (!arena_builder::frozen) {
+    return;
+  }
+
+  bool pending;
+
+  {
+    lock_guard<std::mutex> lock(registration::mutex);
+    pending = registration::first != nullptr;
+  }
+
+  if (pending || yomm11_class::to_initialize || method_base::to_initialize) {
+    throw runtime_error("methods: dispatch data is frozen");
+  }
+}
+
+}
+
+void initialize() {
+  lock_guard<recursive_mutex> lock(registry_mutex());
+  check_not_frozen();
+  reclaimer::reclaim();
+  registration::run_pending();
+
+  if (!yomm11_class::to_initialize && !method_base::to_initialize) {
+    return;
+  }
+
+  YOMM11_PROBE0(initialize__begin);
+
+  if (trace::enabled) {
+    trace::emit(make_event(trace_event::initialize_begin));
+  }
+
+  // If other threads may be dispatching, every column that is about to
+  // be written must be a fresh one: re-slot all the hierarchies that
+  // the methods to be resolved dispatch on.
+  const bool concurrent = reclaimer::readers_registered();
+  unordered_set<const yomm11_class*> slotted;
+
+  for (;;) {
+    while (yomm11_class::to_initialize) {
+      auto pc = *yomm11_class::to_initialize->begin();
+      if (pc->is_root()) {
+        hierarchy_initializer::initialize(*pc, concurrent);
+        slotted.insert(pc);
+      } else {
+        yomm11_class::remove_from_initialize(pc);
+      }
+    }
+
+    if (!concurrent || !method_base::to_initialize) {
+      break;
+    }
+
+    for (auto pm : *method_base::to_initialize) {
+      for (auto pc : pm->vargs) {
+        if (pc->root && slotted.find(pc->root) == slotted.end()) {
+          yomm11_class::add_to_initialize(pc->root);
+        }
+      }
+    }
+
+    if (!yomm11_class::to_initialize) {
+      break;
     }
   }
 
+  int resolved = 0;
+
   while (method_base::to_initialize) {
     auto pm = *method_base::to_initialize->begin();
     pm->resolve();
     method_base::remove_from_initialize(pm);
+    ++resolved;
+  }
+
+  arena_builder::initialize();
+  reclaimer::advance();
+  YOMM11_PROBE1(initialize__end, resolved);
+
+  if (trace::enabled) {
+    trace::emit(make_event(trace_event::initialize_end));
+  }
+
+  if (resolved) {
+    if (ostream* os = dispatch_report_stream()) {
+      write_dispatch_report(*os);
+      os->flush();
+    }
+  }
+}
+
+future<void> initialize_async() {
+  auto done = make_shared<promise<void>>();
+  auto ready = done->get_future();
+  auto run = [done] {
+    try {
+      initialize();
+      done->set_value();
+    } catch (...) {
+      done->set_exception(current_exception());
+    }
+  };
+
+  {
+    // Register the classes loaded since the last call on this thread.
+    // Until the worker publishes the new tables, their objects use the
+    // row of a class to which the same specializations apply. If one
+    // has no such class, it needs cells of its own: resolve now.
+    lock_guard<recursive_mutex> lock(registry_mutex());
+    check_not_frozen();
+    registration::run_pending();
+
+    if (!yomm11_class::make_provisional_rows()) {
+      run();
+      return ready;
+    }
+  }
+
+  // Detached: unlike the future of std::async, the one returned does
+  // not wait for the worker when it is destroyed.
+  thread(run).detach();
+
+  return ready;
+}
+
+void enable_huge_pages(bool enable) {
+  arena_builder::huge_pages = enable;
+}
+
+void freeze() {
+  lock_guard<recursive_mutex> lock(registry_mutex());
+
+  if (arena_builder::frozen) {
+    return;
+  }
+
+  initialize();
+  // rebuild the arena on pages that hold nothing else
+  arena_builder::frozen = true;
+  arena_builder::initialize();
+
+#ifdef __linux__
+  // The arena is on pages of its own unless mmap failed, in which case
+  // it lives on the heap and cannot be protected. Either every mapping
+  // is made read-only, or none is.
+  vector<pair<char*, size_t>> mappings;
+
+  if (arena_builder::arena_size) {
+    mappings.emplace_back(arena_builder::arena_memory, arena_builder::arena_mapped);
+  }
+
+  for (int node = 1; node < YOMM11_MAX_NUMA_NODES; node++) {
+    if (arena_builder::replica_memory[node]) {
+      mappings.emplace_back(arena_builder::replica_memory[node], arena_builder::replica_mapped[node]);
+    }
+  }
+
+  const char* error = nullptr;
+  size_t done = 0;
+
+  for (; done < mappings.size(); done++) {
+    if (!mappings[done].second) {
+      error = "the arena is not mapped";
+      break;
+    }
+
+    if (mprotect(mappings[done].first, mappings[done].second, PROT_READ) != 0) {
+      error = strerror(errno);
+      break;
+    }
+  }
+
+  if (error) {
+    while (done--) {
+      mprotect(mappings[done].first, mappings[done].second, PROT_READ | PROT_WRITE);
+    }
+
+    arena_builder::frozen = false;
+    throw runtime_error(string("methods: cannot make the dispatch data read-only: ") + error);
+  }
+#endif
+}
+
+bool is_frozen() {
+  return arena_builder::frozen;
+}
+
+void set_parallel_threads(int threads) {
+  work_stealing::requested = threads;
+}
+
+void enable_numa_replicas(bool enable) {
+  arena_builder::numa = enable;
+}
+
+int select_replica() {
+  unsigned node = 0;
+#if defined(__linux__) && defined(SYS_getcpu)
+  unsigned cpu;
+  if (syscall(SYS_getcpu, &cpu, &node, nullptr) != 0) {
+    node = 0;
+  }
+#endif
+  select_replica(node);
+  return node;
+}
+
+void select_replica(int node) {
+#ifdef YOMM11_NUMA_REPLICAS
+  replica = node >= 0 && node < arena_builder::replicas() ? node : 0;
+#else
+  (void) node;
+#endif
+}
+
+namespace {
+thread_local reclaimer::reader* this_reader;
+}
+
+void register_thread() {
+  if (!this_reader) {
+    this_reader = new reclaimer::reader;
+    this_reader->seen.store(reclaimer::epoch.load());
+    lock_guard<mutex> lock(reclaimer::mutex);
+    this_reader->next = reclaimer::readers;
+    reclaimer::readers = this_reader;
+  }
+}
+
+void unregister_thread() {
+  if (this_reader) {
+    {
+      lock_guard<mutex> lock(reclaimer::mutex);
+      auto link = &reclaimer::readers;
+      while (*link != this_reader) {
+        link = &(*link)->next;
+      }
+      *link = this_reader->next;
+    }
+    delete this_reader;
+    this_reader = nullptr;
+  }
+}
+
+void quiescent_state() {
+  if (this_reader) {
+    this_reader->seen.store(reclaimer::epoch.load(memory_order_acquire), memory_order_release);
+  }
+}
+
+mutex reclaimer::mutex;
+reclaimer::reader* reclaimer::readers;
+atomic<uint64_t> reclaimer::epoch(1);
+vector<reclaimer::retired_memory>* reclaimer::memory;
+vector<reclaimer::retired_column>* reclaimer::columns;
+
+void detail::retire(void* p, void (*release)(void*, size_t), size_t size) {
+  if (p && !in_arena(p)) {
+    reclaimer::retire(p, release, size);
+  }
+}
+
+bool reclaimer::readers_registered() {
+  lock_guard<std::mutex> lock(mutex);
+  return readers != nullptr;
+}
+
+void reclaimer::retire(void* p, void (*release)(void*, size_t), size_t size) {
+  {
+    lock_guard<std::mutex> lock(mutex);
+
+    if (readers) {
+      if (!memory) {
+        memory = new vector<retired_memory>;
+      }
+      memory->push_back(retired_memory { p, release, size, epoch.load() });
+      return;
+    }
+  }
+
+  release(p, size);
+}
+
+void reclaimer::retire_column(yomm11_class* pc, int slot) {
+  lock_guard<std::mutex> lock(mutex);
+
+  if (readers) {
+    if (!columns) {
+      columns = new vector<retired_column>;
+    }
+    columns->push_back(retired_column { pc, slot, epoch.load() });
+  }
+}
+
+void reclaimer::forget(yomm11_class* pc) {
+  lock_guard<std::mutex> lock(mutex);
+
+  if (columns) {
+    columns->erase(
+        remove_if(columns->begin(), columns->end(), [=](const retired_column& column) { return column.pc == pc; }),
+        columns->end());
+  }
+}
+
+void reclaimer::advance() {
+  epoch.fetch_add(1);
+  reclaim();
+}
+
+void reclaimer::reclaim() {
+  vector<retired_memory> released;
+
+  {
+    lock_guard<std::mutex> lock(mutex);
+    uint64_t oldest = numeric_limits<uint64_t>::max();
+
+    for (reader* r = readers; r; r = r->next) {
+      oldest = min(oldest, r->seen.load(memory_order_acquire));
+    }
+
+    if (memory) {
+      auto still_visible = partition(
+          memory->begin(), memory->end(),
+          [=](const retired_memory& m) { return m.epoch < oldest; });
+      released.assign(memory->begin(), still_visible);
+      memory->erase(memory->begin(), still_visible);
+    }
+
+    if (columns) {
+      columns->erase(
+          remove_if(columns->begin(), columns->end(), [=](const retired_column& column) { return column.epoch < oldest; }),
+          columns->end());
+    }
+  }
+
+  for (auto& m : released) {
+    m.release(m.p, m.size);
   }
 }
 
+size_t reclaimer::pending() {
+  lock_guard<std::mutex> lock(mutex);
+  return (memory ? memory->size() : 0) + (columns ? columns->size() : 0);
+}
+
 specialization_base::~specialization_base() {
 }
 
@@ -281,14 +1286,70 @@ void yomm11_class::add_method(method_base* pm, int arg) {
   add_to_initialize(this);
 }
 
+// The columns of the method are left unused, not reclaimed: the slots
+// of the other methods stay valid. The next re-slot of the hierarchy
+// compacts the rows.
 void yomm11_class::remove_method(method_base* pm) {
   rooted_here.erase(
       remove_if(rooted_here.begin(), rooted_here.end(), [=](method_param& ref) { return ref.method == pm;  }),
       rooted_here.end());
-  add_to_initialize(root);
 }
 
-get_mm_table<false>::class_of_type* get_mm_table<false>::class_of;
+atomic<const get_mm_table<false>::class_of_type*> get_mm_table<false>::class_of;
+get_mm_table<false>::class_of_type* get_mm_table<false>::draft;
+atomic<const get_mm_table<false>::frozen_class*> get_mm_table<false>::frozen;
+size_t get_mm_table<false>::frozen_mask;
+
+void get_mm_table<false>::add(type_index type, const yomm11_class::mm_table* mmt) {
+  if (!draft) {
+    auto published = class_of.load(memory_order_relaxed);
+    draft = published ? new class_of_type(*published) : new class_of_type;
+  }
+
+  (*draft)[type] = mmt;
+}
+
+namespace {
+struct unknown_class : undefined {
+  explicit unknown_class(const type_info& type) :
+      undefined(string("multi-method call on an unregistered class: ") + type.name()) {
+  }
+};
+}
+
+void get_mm_table<false>::unknown(const type_info& type) {
+  throw unknown_class(type);
+}
+
+bool get_mm_table<false>::remove(const yomm11_class::mm_table* mmt) {
+  auto published = class_of.load(memory_order_relaxed);
+  const class_of_type* from = draft ? draft : published;
+
+  if (!from || find_if(from->begin(), from->end(), [=](const class_of_type::value_type& entry) { return entry.second == mmt; }) == from->end()) {
+    return false;
+  }
+
+  if (!draft) {
+    draft = new class_of_type(*published);
+  }
+
+  for (auto iter = draft->begin(); iter != draft->end(); ) {
+    iter = iter->second == mmt ? draft->erase(iter) : next(iter);
+  }
+
+  // the frozen copy is stale until the arena is rebuilt
+  frozen.store(nullptr, memory_order_release);
+
+  return true;
+}
+
+void get_mm_table<false>::publish() {
+  if (draft) {
+    auto published = class_of.exchange(draft, memory_order_release);
+    draft = nullptr;
+    retire(const_cast<class_of_type*>(published), [](void* p, size_t) { delete static_cast<class_of_type*>(p); });
+  }
+}
 
 ostream& operator <<(ostream& os, const vector<yomm11_class*>& classes) {
   using namespace std;
@@ -303,17 +1364,38 @@ ostream& operator <<(ostream& os, const vector<yomm11_class*>& classes) {
   return os << ")";
 }
 
-method_base::method_base(const vector<yomm11_class*>& v YOMM11_COMMA_TRACE(const char* name))
-  : vargs(v) YOMM11_COMMA_TRACE(name(name)) {
+method_base* method_base::first;
+method_base* method_base::last;
+
+method_base::method_base(const vector<yomm11_class*>& v, const char* name)
+  : vargs(v), dispatch(nullptr), name(name), buried(false), table_size(0), undefined_cells(0), ambiguous_cells(0), next(nullptr) {
+  lock_guard<recursive_mutex> lock(registry_mutex());
+#ifdef YOMM11_ENABLE_PROFILE
+  {
+    lock_guard<std::mutex> profile_lock(profile::mutex);
+    profile_id = profile::methods++;
+  }
+  undefined_calls = ambiguous_calls = 0;
+#endif
+#ifdef YOMM11_NUMA_REPLICAS
+  for (auto& replica : replicas) {
+    replica.store(nullptr, memory_order_relaxed);
+  }
+#endif
+  prev = last;
+  (last ? last->next : first) = this;
+  last = this;
   int i = 0;
   for (auto pc : vargs) {
-    YOMM11_TRACE(cout << "add " << name << " rooted in " << pc->name << " argument " << i << "\n");
     pc->add_method(this, i++);
   }
   slots.resize(v.size());
+  shared_slots.resize(v.size());
 }
 
 method_base::~method_base() {
+  lock_guard<recursive_mutex> lock(registry_mutex());
+
   for (auto method_iter = methods.rbegin(); method_iter != methods.rend(); method_iter++) {
     delete *method_iter;
     *method_iter = 0;
@@ -324,6 +1406,67 @@ method_base::~method_base() {
   }
 
   remove_from_initialize(this);
+  retire_array(reinterpret_cast<const char*>(dispatch.load(memory_order_relaxed)));
+
+  if (!buried) {
+    (prev ? prev->next : first) = next;
+    (next ? next->prev : last) = prev;
+  }
+}
+
+namespace {
+// Keeps the tombstones reachable: the method<> that points to one may
+// be gone with its shared object. Never destroyed, as classes are
+// unloaded during static destruction too.
+vector<method_base*>* tombstones;
+}
+
+void method_base::bury() {
+#ifdef YOMM11_ENABLE_PROFILE
+  profile::fold(this);
+  profile_cells.clear();
+#endif
+
+  for (auto spec : methods) {
+    delete spec;
+  }
+
+  methods.clear();
+
+  for (yomm11_class* arg : vargs) {
+    arg->remove_method(this);
+  }
+
+  remove_from_initialize(this);
+  (prev ? prev->next : first) = next;
+  (next ? next->prev : last) = prev;
+  buried = true;
+  if (!tombstones) {
+    tombstones = new vector<method_base*>;
+  }
+
+  tombstones->push_back(this);
+
+  // one cell, reached whatever the arguments: all the steps are zero
+  const int dims = vargs.size();
+  allocate_dispatch_table(1);
+  emit(&specialization_base::undefined, 0);
+  header* tombstone = new (new char[header::size(dims)]) header;
+  tombstone->table = get_dispatch_table();
+#ifdef YOMM11_COMPACT_DISPATCH
+  tombstone->targets = get_targets();
+#endif
+  fill(tombstone->slots_and_steps(), tombstone->slots_and_steps() + 2 * dims, 0);
+  retire_array(reinterpret_cast<const char*>(exchange_header(tombstone)));
+
+  vargs.clear();
+  slots.clear();
+  shared_slots.clear();
+  steps.clear();
+  groups.clear();
+  table_size = 1;
+  undefined_cells = 1;
+  ambiguous_cells = 0;
 }
 
 void method_base::assign_slot(int arg, int slot) {
@@ -331,104 +1474,381 @@ void method_base::assign_slot(int arg, int slot) {
   invalidate();
 }
 
-void method_base::invalidate() {
-  YOMM11_TRACE(cout << "add " << name << " to init list" << endl);
-  add_to_initialize(this);
+void method_base::publish() {
+  header* new_header = new (new char[header::size(vargs.size())]) header;
+  new_header->table = get_dispatch_table();
+#ifdef YOMM11_COMPACT_DISPATCH
+  new_header->targets = get_targets();
+#endif
+
+  for (size_t dim = 0; dim < vargs.size(); dim++) {
+    new_header->slots_and_steps()[2 * dim] = slots[dim];
+    new_header->slots_and_steps()[2 * dim + 1] = steps[dim];
+  }
+
+  auto old_header = exchange_header(new_header);
+
+  if (old_header) {
+    for (size_t dim = 0; dim < vargs.size(); dim++) {
+      if (old_header->slots_and_steps()[2 * dim] != slots[dim]) {
+        reclaimer::retire_column(vargs[dim], old_header->slots_and_steps()[2 * dim]);
+      }
+    }
+
+    retire_array(reinterpret_cast<const char*>(old_header));
+  }
 }
 
-unordered_set<method_base*>* method_base::to_initialize;
+const method_base::header* method_base::exchange_header(const header* new_header) {
+  auto old_header = dispatch.exchange(new_header, memory_order_release);
 
-void method_base::add_to_initialize(method_base* pm) {
-  if (!to_initialize) {
-    to_initialize = new unordered_set<method_base*>;
+#ifdef YOMM11_NUMA_REPLICAS
+  for (auto& replica : replicas) {
+    replica.store(new_header, memory_order_release);
   }
+#endif
 
-  to_initialize->insert(pm);
+  return old_header;
 }
 
-void method_base::remove_from_initialize(method_base* pm) {
-  if (to_initialize) {
-    to_initialize->erase(pm);
+void method_base::replicate_cells(const vector<int>& cells, int target) {
+#ifdef YOMM11_NUMA_REPLICAS
+  auto primary = dispatch.load(memory_order_relaxed);
 
-    if (to_initialize->empty()) {
-      delete to_initialize;
-      to_initialize = nullptr;
+  if (!primary) {
+    return;
+  }
+
+  for (auto& replica : replicas) {
+    auto copy = const_cast<header*>(replica.load(memory_order_relaxed));
+
+    if (!copy || copy->table == primary->table) {
+      continue;
+    }
+
+#ifdef YOMM11_COMPACT_DISPATCH
+    (void) cells;
+    store_release(copy->targets[target], primary->targets[target]);
+#else
+    (void) target;
+    for (int cell : cells) {
+      store_release(copy->table[cell], primary->table[cell]);
     }
+#endif
   }
+#else
+  (void) cells;
+  (void) target;
+#endif
 }
 
-void method_base::resolve() {
-  grouping_resolver r(*this);
-  r.resolve();
+void method_base::invalidate_shared_slots() {
+  for (size_t arg = 0; arg < vargs.size(); arg++) {
+    if (shared_slots[arg]) {
+      yomm11_class::add_to_initialize(vargs[arg]->root);
+    }
+  }
 }
 
-grouping_resolver::grouping_resolver(method_base& mm) : mm(mm), dims(mm.vargs.size()) {
-}
+void method_base::remove_spec(specialization_base* spec) {
+#ifdef YOMM11_ENABLE_PROFILE
+  // the cells that lead to spec are about to lead nowhere
+  profile::fold(this);
+  profile_cells.clear();
+#endif
+  methods.erase(find(methods.begin(), methods.end(), spec));
+  delete spec;
 
-void grouping_resolver::resolve() {
-  make_groups();
-  make_table();
-  assign_next();
+  for (size_t i = 0; i < methods.size(); i++) {
+    methods[i]->index = i;
+  }
+
+  invalidate();
+  // groups may merge
+  invalidate_shared_slots();
 }
 
-void grouping_resolver::make_groups() {
-  groups.resize(dims);
+void method_base::remove_specs_using(const yomm11_class* pc) {
+  for (size_t i = methods.size(); i--; ) {
+    auto& args = methods[i]->args;
+    if (find(args.begin(), args.end(), pc) != args.end()) {
+      remove_spec(methods[i]);
+    }
+  }
+}
 
-  int dim = 0;
-  mm.steps.resize(dims);
-  int step = 1;
+// The groups stay as they are if, in each dimension, a group conforms
+// to the argument of the new specialization as a whole or not at all.
+// Then only the cells at the crossing of the groups that conform may
+// change.
+vector<int> method_base::insert_in_place(specialization_base* spec) {
+  unique_ptr<specialization_base> owner(spec);
 
-  for (auto& dim_groups : groups) {
-    YOMM11_TRACE(cout << "make_groups dim = " << dim << endl);
+  if (!get_dispatch_table() || (to_initialize && to_initialize->count(this))
+      || yomm11_class::to_initialize) {
+    throw runtime_error("methods: initialize() must run before a specialization is inserted");
+  }
 
-    unordered_set<const yomm11_class*> once;
-    mm.steps[dim] = step;
+  const int dims = vargs.size();
+  // per dimension, the offsets of the groups that conform to the
+  // argument, and a class from each
+  vector<vector<int>> offsets(dims);
+  vector<vector<yomm11_class*>> classes(dims);
+
+  for (int dim = 0; dim < dims; dim++) {
+    const int slot = slots[dim];
+    const yomm11_class& arg = *spec->args[dim];
+    vector<int> conforms(groups[dim], -1);
+    vector<yomm11_class*> sample(groups[dim], nullptr);
+    class_set once;
+
+    vargs[dim]->for_each_conforming(once, [&](yomm11_class* pc) {
+#ifdef YOMM11_COMPACT_DISPATCH
+        const int offset = pc->mmt.latest()[slot].index;
+#else
+        const int offset = dim == 0
+          ? pc->mmt.latest()[slot].ptr - get_dispatch_table()
+          : pc->mmt.latest()[slot].index;
+#endif
+        const int value = pc->conforms_to(arg);
 
-    mm.vargs[dim]->for_each_conforming(once, [&](yomm11_class* pc) {
-        group g;
-        find_applicable(dim, pc, g.methods);
-        g.classes.push_back(pc);
-        make_mask(g.methods, g.mask);
-        YOMM11_TRACE(cout << pc << " has " << g.methods << endl);
-        auto lower = lower_bound(
-            dim_groups.begin(), dim_groups.end(), g,
-            []( const group& g1, const group& g2) { return g1.mask < g2.mask; });
-
-        if (lower == dim_groups.end() || g.mask < lower->mask) {
-          YOMM11_TRACE(cout << "create new group" << endl);
-          dim_groups.insert(lower, g);
-        } else {
-          YOMM11_TRACE(cout << "add " << pc << " to existing group " << lower->methods << endl);
-          lower->classes.push_back(pc);
+        if (conforms[offset] == -1) {
+          conforms[offset] = value;
+          sample[offset] = pc;
+        } else if (conforms[offset] != value) {
+          conforms[offset] = 2;
         }
       });
 
-    step *= dim_groups.size();
-
-    YOMM11_TRACE(cout << "assign slots" << endl);
-
-    int offset = 0;
+    for (int offset = 0; offset < groups[dim]; offset++) {
+      if (conforms[offset] == 2) {
+        throw runtime_error("methods: specialization would split a group, call initialize()");
+      }
 
-    for (auto& group : dim_groups) {
-      for (auto pc : group.classes) {
-        YOMM11_TRACE(cout << pc << ": " << offset << endl);
-        pc->mmt[mm.slots[dim]].index = offset;
+      if (conforms[offset] == 1) {
+        offsets[dim].push_back(offset);
+        classes[dim].push_back(sample[offset]);
       }
-      ++offset;
     }
-
-    ++dim;
   }
 
-  dispatch_table = mm.allocate_dispatch_table(step);
-}
+  methods.push_back(owner.release());
 
-void grouping_resolver::make_table() {
-  YOMM11_TRACE(cout << "Creating dispatch table for " << mm.name << endl);
+#ifdef YOMM11_COMPACT_DISPATCH
+  // The targets grow by one. The table is copied too: a thread that
+  // still reads the old header must not find an index past the end of
+  // the old targets.
+  vector<dispatch_cell> cells_before(get_dispatch_table(), get_dispatch_table() + table_size);
+  copy(cells_before.begin(), cells_before.end(), allocate_dispatch_table(table_size));
+#endif
 
-  emit_at = 0;
-  resolve(dims - 1, ~bitvec(mm.methods.size()));
+  grouping_resolver resolver(*this);
+  vector<int> cells;
+  bool empty = false;
 
+  for (auto& dim_offsets : offsets) {
+    empty = empty || dim_offsets.empty();
+  }
+
+  for (vector<size_t> at(dims); !empty; ) {
+    int cell = 0;
+    vector<specialization_base*> applicable;
+
+    for (int dim = 0; dim < dims; dim++) {
+      cell += offsets[dim][at[dim]] * steps[dim];
+    }
+
+    for (auto method : methods) {
+      bool applies = method != spec;
+
+      for (int dim = 0; applies && dim < dims; dim++) {
+        applies = classes[dim][at[dim]]->conforms_to(*method->args[dim]);
+      }
+
+      if (applies) {
+        applicable.push_back(method);
+      }
+    }
+
+    specialization_base* before = resolver.find_best(applicable);
+    applicable.push_back(spec);
+    specialization_base* best = resolver.find_best(applicable);
+
+    if (best != before) {
+      if (before == &specialization_base::undefined) {
+        --undefined_cells;
+      } else if (before == &specialization_base::ambiguous) {
+        --ambiguous_cells;
+      }
+
+      if (best == &specialization_base::ambiguous) {
+        ++ambiguous_cells;
+      }
+
+      if (trace::enabled) {
+        trace_event event = make_event(trace_event::cell_emitted, name);
+        event.index = cell;
+        event.specialization = describe(best);
+        trace::emit(event);
+      }
+
+#ifdef YOMM11_ENABLE_PROFILE
+      if (size_t(cell) < profile_cells.size()) {
+        profile_cells[cell] = best;
+      }
+#endif
+      emit(best, cell);
+      cells.push_back(cell);
+    }
+
+    int dim = 0;
+
+    while (dim < dims && ++at[dim] == offsets[dim].size()) {
+      at[dim++] = 0;
+    }
+
+    if (dim == dims) {
+      break;
+    }
+  }
+
+#ifdef YOMM11_COMPACT_DISPATCH
+  publish();
+#else
+  replicate_cells(cells, 0);
+#endif
+  resolver.assign_next();
+
+  return cells;
+}
+
+void method_base::invalidate() {
+  add_to_initialize(this);
+}
+
+unordered_set<method_base*>* method_base::to_initialize;
+
+void method_base::add_to_initialize(method_base* pm) {
+  if (!to_initialize) {
+    to_initialize = new unordered_set<method_base*>;
+  }
+
+  to_initialize->insert(pm);
+}
+
+void method_base::remove_from_initialize(method_base* pm) {
+  if (to_initialize) {
+    to_initialize->erase(pm);
+
+    if (to_initialize->empty()) {
+      delete to_initialize;
+      to_initialize = nullptr;
+    }
+  }
+}
+
+void method_base::resolve() {
+#ifdef YOMM11_ENABLE_PROFILE
+  profile::fold(this);
+#endif
+  YOMM11_PROBE1(resolve__begin, name);
+  grouping_resolver r(*this);
+  r.resolve();
+  YOMM11_PROBE3(resolve__end, name, undefined_cells, ambiguous_cells);
+}
+
+grouping_resolver::grouping_resolver(method_base& mm) : mm(mm), dims(mm.vargs.size()) {
+}
+
+void grouping_resolver::resolve() {
+  make_groups();
+  make_table();
+  assign_next();
+}
+
+void grouping_resolver::make_groups() {
+  groups.resize(dims);
+
+  int dim = 0;
+  mm.steps.resize(dims);
+  mm.groups.resize(dims);
+  int step = 1;
+
+  for (auto& dim_groups : groups) {
+    mm.steps[dim] = step;
+    make_groups(dim, dim_groups);
+    mm.groups[dim] = dim_groups.size();
+    step *= dim_groups.size();
+
+    int offset = 0;
+
+    for (auto& group : dim_groups) {
+      if (trace::enabled) {
+        trace_event event = make_event(trace_event::group_created, mm.name);
+        event.arg = dim;
+        event.index = offset;
+        event.classes = names(group.classes);
+        trace::emit(event);
+      }
+
+      for (auto pc : group.classes) {
+        pc->mmt[mm.slots[dim]].index = offset;
+      }
+      ++offset;
+    }
+
+    ++dim;
+  }
+
+  mm.table_size = step;
+  dispatch_table = mm.allocate_dispatch_table(step);
+}
+
+void grouping_resolver::make_groups(int dim, vector<group>& dim_groups) {
+  unordered_set<const yomm11_class*> once;
+
+  mm.vargs[dim]->for_each_conforming(once, [&](yomm11_class* pc) {
+      group g;
+      find_applicable(dim, pc, g.methods);
+      g.classes.push_back(pc);
+      make_mask(g.methods, g.mask);
+      auto lower = lower_bound(
+          dim_groups.begin(), dim_groups.end(), g,
+          []( const group& g1, const group& g2) { return g1.mask < g2.mask; });
+
+      if (lower == dim_groups.end() || g.mask < lower->mask) {
+        dim_groups.insert(lower, g);
+      } else {
+        lower->classes.push_back(pc);
+      }
+    });
+}
+
+vector<int> grouping_resolver::numbering(int dim) {
+  vector<group> dim_groups;
+  make_groups(dim, dim_groups);
+  vector<int> result(mm.vargs[dim]->mask.size(), -1);
+  int offset = 0;
+
+  for (auto& group : dim_groups) {
+    for (auto pc : group.classes) {
+      result[pc->index] = offset;
+    }
+    ++offset;
+  }
+
+  return result;
+}
+
+void grouping_resolver::make_table() {
+  emit_at = 0;
+  mm.undefined_cells = mm.ambiguous_cells = 0;
+#ifdef YOMM11_ENABLE_PROFILE
+  mm.profile_cells.assign(mm.table_size, nullptr);
+#endif
+  resolve(dims - 1, ~bitvec(mm.methods.size()));
+
+#ifndef YOMM11_COMPACT_DISPATCH
   const int first_slot = mm.slots[0];
 
   bitvec once;
@@ -445,23 +1865,49 @@ void grouping_resolver::make_table() {
       }
     }
   }
+#endif
+
+  // the rows first, then the header that refers to them: a thread that
+  // sees the new header also sees the new rows
+  for (auto& dim_groups : groups) {
+    for (auto& group : dim_groups) {
+      for (auto pc : group.classes) {
+        pc->mmt.publish();
+      }
+    }
+  }
+
+  mm.publish();
 }
 
 void grouping_resolver::resolve(int dim, const bitvec& candidates) {
   using namespace std;
-  YOMM11_TRACE(cout << "resolve dim = " << dim << endl);
 
   for (auto& group : groups[dim]) {
     if (dim == 0) {
       specialization_base* best = find_best(candidates & group.mask);
-      YOMM11_TRACE(cout << "install " << best << " at offset " << emit_at << endl);
+
+      if (trace::enabled) {
+        trace_event event = make_event(trace_event::cell_emitted, mm.name);
+        event.index = emit_at;
+        event.specialization = describe(best);
+        trace::emit(event);
+      }
+
+      if (best == &specialization_base::undefined) {
+        ++mm.undefined_cells;
+      } else if (best == &specialization_base::ambiguous) {
+        ++mm.ambiguous_cells;
+      }
+#ifdef YOMM11_ENABLE_PROFILE
+      mm.profile_cells[emit_at] = best;
+#endif
       mm.emit(best, emit_at++);
     } else {
       resolve(dim - 1, candidates & group.mask);
     }
   }
 
-  YOMM11_TRACE(cout << "exiting dim " << dim << endl);
 }
 
 specialization_base* grouping_resolver::find_best(const vector<specialization_base*>& candidates) {
@@ -474,10 +1920,8 @@ specialization_base* grouping_resolver::find_best(const vector<specialization_ba
 
     while (best_iter != best.end()) {
       if (method->specializes(*best_iter)) {
-        YOMM11_TRACE(cout << method << " specializes " << *best_iter << ", removed\n");
         best_iter = best.erase(best_iter);
       } else if ((*best_iter)->specializes(method)) {
-        YOMM11_TRACE(cout << *best_iter << " specializes " << method << ", removed\n");
         best_iter = best.end();
         method = 0;
       } else {
@@ -486,7 +1930,6 @@ specialization_base* grouping_resolver::find_best(const vector<specialization_ba
     }
 
     if (method) {
-      YOMM11_TRACE(cout << method << " kept\n");
       best.push_back(method);
     }
   }
@@ -518,10 +1961,15 @@ void grouping_resolver::assign_next() {
         [&](specialization_base* other) {
           return pm != other && pm->specializes(other);
         });
-    YOMM11_TRACE(cout << "calculating next for " << pm << ", candidates:\n");
-    YOMM11_TRACE(copy(candidates.begin(), candidates.end(), ostream_iterator<specialization_base*>(cout, "\n")));
     auto best = find_best(candidates);
-    YOMM11_TRACE(cout << "next is: " << best << endl);
+
+    if (trace::enabled) {
+      trace_event event = make_event(trace_event::next_assigned, mm.name);
+      event.specialization = describe(pm);
+      event.next = describe(best);
+      trace::emit(event);
+    }
+
     mm.emit_next(pm, best);
   }
 }
@@ -534,63 +1982,944 @@ void grouping_resolver::make_mask(const vector<specialization_base*>& methods, b
   }
 }
 
-namespace detail {
+char* arena_builder::arena_memory;
+char* arena_builder::arena_base;
+size_t arena_builder::arena_size;
+size_t arena_builder::arena_mapped;
+bool arena_builder::huge_pages;
+bool arena_builder::frozen;
+bool arena_builder::numa;
+int arena_builder::numa_nodes;
+char* arena_builder::replica_memory[YOMM11_MAX_NUMA_NODES];
+size_t arena_builder::replica_mapped[YOMM11_MAX_NUMA_NODES];
+
+bool detail::in_arena(const void* p) {
+  return p >= arena_builder::arena_base
+      && p < arena_builder::arena_base + arena_builder::arena_size;
+}
 
-#ifdef YOMM11_ENABLE_TRACE
+void arena_builder::initialize() {
+  arena_builder builder;
+  builder.execute();
+}
 
-std::ostream& operator <<(std::ostream& os, const yomm11_class* pc) {
-  if (pc) {
-    os << pc->name;
-  } else {
-    os << "(null)";
+static size_t align(size_t at, size_t alignment) {
+  return (at + alignment - 1) / alignment * alignment;
+}
+
+int arena_builder::replicas() {
+#ifdef YOMM11_NUMA_REPLICAS
+  if (!numa) {
+    return 1;
   }
-  return os;
+
+  if (!numa_nodes) {
+    // e.g. "0-1" or "0,2-3"; the copies are indexed by node number
+    numa_nodes = 1;
+    ifstream online("/sys/devices/system/node/online");
+    string range;
+
+    while (getline(online, range, ',')) {
+      auto dash = range.find('-');
+      int last = stoi(dash == string::npos ? range : range.substr(dash + 1));
+      numa_nodes = max(numa_nodes, last + 1);
+    }
+  }
+
+  return min(numa_nodes, YOMM11_MAX_NUMA_NODES);
+#else
+  return 1;
+#endif
 }
 
-ostream& operator <<(ostream& os, specialization_base* method) {
-  using namespace std;
+char* arena_builder::allocate(size_t size, size_t& mapped, int node) {
+#ifdef __linux__
+  const bool use_huge_pages =
+#ifdef MADV_HUGEPAGE
+      huge_pages;
+#else
+      false;
+#endif
 
-  if (method == &specialization_base::undefined) {
-    return os << "undefined";
+  if (use_huge_pages || node >= 0 || frozen) {
+    const size_t page = use_huge_pages ? 2 * 1024 * 1024 : sysconf(_SC_PAGESIZE);
+    mapped = align(size, page);
+    void* memory = mmap(nullptr, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (memory != MAP_FAILED) {
+#ifdef MADV_HUGEPAGE
+      // advisory only: the kernel may or may not back the arena with
+      // huge pages
+      if (use_huge_pages) {
+        madvise(memory, mapped, MADV_HUGEPAGE);
+      }
+#endif
+#ifdef SYS_mbind
+      if (node >= 0 && node < 8 * int(sizeof(unsigned long))) {
+        // Pages are allocated on first touch, i.e. by the copy that
+        // follows. Prefer the node; fall back on others if it is full.
+        const int mpol_preferred = 1;
+        unsigned long nodes = 1ul << node;
+        syscall(SYS_mbind, memory, mapped, mpol_preferred, &nodes, 8 * sizeof(nodes), 0);
+      }
+#endif
+      return static_cast<char*>(memory);
+    }
   }
+#endif
 
-  if (method == &specialization_base::ambiguous) {
-    return os << "ambiguous";
+  mapped = 0;
+  return new char[size + cache_line];
+}
+
+void arena_builder::release(char* memory, size_t mapped) {
+#ifdef __linux__
+  if (mapped) {
+    munmap(memory, mapped);
+    return;
   }
+#endif
 
-  const char* sep = "(";
+  delete [] memory;
+}
 
-  for (yomm11_class* pc : method->args) {
-    os << sep;
-    sep = ", ";
-    os << pc->name;
+void arena_builder::collect_classes() {
+  unordered_set<const yomm11_class*> once;
+
+  for (yomm11_class* pc = yomm11_class::first; pc; pc = pc->next) {
+    if (pc->root && pc->is_root()) {
+      hierarchy_initializer hierarchy(*pc);
+      hierarchy.collect_classes();
+
+      for (yomm11_class* node : hierarchy.nodes) {
+        if (once.insert(node).second) {
+          classes.push_back(node);
+        }
+      }
+    }
   }
 
-  return os << ")";
+  for (method_base* pm = method_base::first; pm; pm = pm->next) {
+    if (pm->dispatch.load(memory_order_relaxed)) {
+      methods.push_back(pm);
+    }
+  }
 }
 
-ostream& operator <<(ostream& os, const method_base* mm) {
-  return os << mm->name << mm->vargs;
+void arena_builder::layout() {
+  size = 0;
+
+  // classes that behave alike have identical rows: store them once
+  unordered_map<string, size_t> rows;
+
+  for (yomm11_class* pc : classes) {
+    string entries(
+        reinterpret_cast<const char*>(pc->mmt.latest()),
+        pc->mmt.size() * sizeof(yomm11_class::offset));
+    auto row_iter = rows.find(entries);
+
+    if (row_iter != rows.end()) {
+      row_at[pc] = row_iter->second;
+    } else {
+      rows[entries] = row_at[pc] = size;
+      size += pc->mmt.size() * sizeof(yomm11_class::offset);
+    }
+  }
+
+#ifdef YOMM11_COMPACT_DISPATCH
+  // methods that share their slots often end up with identical tables
+  unordered_map<string, size_t> tables;
+#endif
+
+  for (method_base* pm : methods) {
+    if (pm->get_dispatch_table()) {
+#ifdef YOMM11_COMPACT_DISPATCH
+      string cells(
+          reinterpret_cast<const char*>(pm->get_dispatch_table()),
+          pm->table_size * sizeof(method_base::dispatch_cell));
+      auto table_iter = tables.find(cells);
+
+      if (table_iter != tables.end()) {
+        table_at[pm] = table_iter->second;
+      } else {
+        size = align(size, cache_line);
+        tables[cells] = table_at[pm] = size;
+        size += pm->table_size * sizeof(method_base::dispatch_cell);
+      }
+#else
+      size = align(size, cache_line);
+      table_at[pm] = size;
+      size += pm->table_size * sizeof(method_base::dispatch_cell);
+#endif
+#ifdef YOMM11_COMPACT_DISPATCH
+      size = align(size, sizeof(method_base::void_function_pointer));
+      targets_at[pm] = size;
+      size += pm->targets_size() * sizeof(method_base::void_function_pointer);
+#endif
+    }
+  }
+
+  for (method_base* pm : methods) {
+    size = align(size, alignof(method_base::header));
+    header_at[pm] = size;
+    size += method_base::header::size(pm->vargs.size());
+  }
+
+  foreign_size = 0;
+
+  if (frozen) {
+    auto class_of = get_mm_table<false>::class_of.load(memory_order_relaxed);
+
+    if (class_of && !class_of->empty()) {
+      // at most half full: probe sequences stay short
+      foreign_size = 2;
+      while (foreign_size < 2 * class_of->size()) {
+        foreign_size *= 2;
+      }
+      size = align(size, cache_line);
+      foreign_at = size;
+      size += foreign_size * sizeof(get_mm_table<false>::frozen_class);
+    }
+  }
 }
 
-ostream& operator <<(ostream& os, const vector<specialization_base*>& methods) {
-  using namespace std;
-  const char* sep = "";
+void arena_builder::copy() {
+  for (yomm11_class* pc : classes) {
+    memcpy(base + row_at[pc], pc->mmt.latest(), pc->mmt.size() * sizeof(yomm11_class::offset));
+  }
 
-  for (specialization_base* pm : methods) {
-    os << sep;
-    sep = " ";
-    os << pm;
+  if (foreign_size) {
+    auto table = reinterpret_cast<get_mm_table<false>::frozen_class*>(base + foreign_at);
+    uninitialized_fill_n(table, foreign_size, get_mm_table<false>::frozen_class { typeid(void), nullptr });
+
+    for (auto& entry : *get_mm_table<false>::class_of.load(memory_order_relaxed)) {
+      size_t i = entry.first.hash_code() & (foreign_size - 1);
+      while (table[i].mmt) {
+        i = (i + 1) & (foreign_size - 1);
+      }
+      table[i] = get_mm_table<false>::frozen_class { entry.first, entry.second };
+    }
   }
 
-  return os;
+  for (method_base* pm : methods) {
+    const int dims = pm->vargs.size();
+    auto header = new (base + header_at[pm]) method_base::header(*pm->dispatch.load(memory_order_relaxed));
+    memcpy(header->slots_and_steps(), pm->dispatch.load(memory_order_relaxed)->slots_and_steps(), 2 * dims * sizeof(int));
+
+    auto table_iter = table_at.find(pm);
+
+    if (table_iter == table_at.end()) {
+      continue;
+    }
+
+    auto from = pm->get_dispatch_table();
+    auto to = reinterpret_cast<method_base::dispatch_cell*>(base + table_iter->second);
+    memcpy(to, from, pm->table_size * sizeof(method_base::dispatch_cell));
+    header->table = to;
+
+#ifdef YOMM11_COMPACT_DISPATCH
+    memcpy(base + targets_at[pm], pm->get_targets(), pm->targets_size() * sizeof(method_base::void_function_pointer));
+    header->targets = reinterpret_cast<method_base::void_function_pointer*>(base + targets_at[pm]);
+#else
+    // the first virtual argument's slot points inside the table
+    const int first_slot = pm->slots[0];
+    unordered_set<const yomm11_class*> once;
+
+    pm->vargs[0]->for_each_conforming(once, [&](yomm11_class* pc) {
+        if (first_slot < pc->mmt.size()) {
+          auto& entry = reinterpret_cast<yomm11_class::offset*>(base + row_at[pc])[first_slot];
+          if (entry.ptr >= from && entry.ptr < from + pm->table_size) {
+            entry.ptr = to + (entry.ptr - from);
+          }
+        }
+      });
+#endif
+  }
 }
 
-ostream& operator <<(ostream& os, const method_base* mm) {
-  return os << "mm" << mm->vargs;
+// Points the tables and rows of a copy of the arena inside the copy.
+void arena_builder::relocate(char* replica) {
+  auto moved = [=](const void* p) {
+    return replica + (static_cast<const char*>(p) - base);
+  };
+
+  for (method_base* pm : methods) {
+    if (table_at.find(pm) == table_at.end()) {
+      continue;
+    }
+
+    auto header = reinterpret_cast<method_base::header*>(replica + header_at[pm]);
+    header->table = reinterpret_cast<method_base::dispatch_cell*>(moved(header->table));
+#ifdef YOMM11_COMPACT_DISPATCH
+    header->targets = reinterpret_cast<method_base::void_function_pointer*>(moved(header->targets));
+#else
+    const int first_slot = pm->slots[0];
+    unordered_set<const yomm11_class*> once;
+
+    pm->vargs[0]->for_each_conforming(once, [&](yomm11_class* pc) {
+        if (first_slot < pc->mmt.size()) {
+          auto& entry = reinterpret_cast<yomm11_class::offset*>(replica + row_at[pc])[first_slot];
+          // rows may be shared: relocate once
+          if (reinterpret_cast<const char*>(entry.ptr) >= base
+              && reinterpret_cast<const char*>(entry.ptr) < base + size) {
+            entry.ptr = reinterpret_cast<void (**)()>(moved(entry.ptr));
+          }
+        }
+      });
+#endif
+  }
 }
 
+void arena_builder::execute() {
+  collect_classes();
+  layout();
+  const int nodes = replicas();
+  memory = allocate(size, mapped, nodes > 1 ? 0 : -1);
+  base = reinterpret_cast<char*>(align(reinterpret_cast<size_t>(memory), cache_line));
+  copy();
+
+  char* replica_base[YOMM11_MAX_NUMA_NODES] = { base };
+  char* previous_replicas[YOMM11_MAX_NUMA_NODES];
+  size_t previous_replicas_mapped[YOMM11_MAX_NUMA_NODES];
+
+  for (int node = 1; node < YOMM11_MAX_NUMA_NODES; node++) {
+    previous_replicas[node] = replica_memory[node];
+    previous_replicas_mapped[node] = replica_mapped[node];
+    replica_memory[node] = nullptr;
+    replica_mapped[node] = 0;
+
+    if (node < nodes) {
+      replica_memory[node] = allocate(size, replica_mapped[node], node);
+      replica_base[node] = reinterpret_cast<char*>(align(reinterpret_cast<size_t>(replica_memory[node]), cache_line));
+      memcpy(replica_base[node], base, size);
+      relocate(replica_base[node]);
+    }
+  }
+
+  // Publish the rows, then the headers that refer to them. The storage
+  // being replaced is retired while in_arena() still refers to the old
+  // arena.
+  for (yomm11_class* pc : classes) {
+    if (pc->mmt.size()) {
+      pc->mmt.publish(reinterpret_cast<yomm11_class::offset*>(base + row_at[pc]));
+#ifdef YOMM11_NUMA_REPLICAS
+      for (int node = 1; node < nodes; node++) {
+        pc->mmt.replicas[node].store(reinterpret_cast<yomm11_class::offset*>(replica_base[node] + row_at[pc]), memory_order_release);
+      }
+#endif
+    }
+  }
+
+  for (method_base* pm : methods) {
+    auto table_iter = table_at.find(pm);
+
+    if (table_iter != table_at.end()) {
+      pm->set_dispatch_table(reinterpret_cast<method_base::dispatch_cell*>(base + table_iter->second));
+#ifdef YOMM11_COMPACT_DISPATCH
+      pm->set_targets(reinterpret_cast<method_base::void_function_pointer*>(base + targets_at[pm]));
+#endif
+    }
+
+    auto header = reinterpret_cast<const method_base::header*>(base + header_at[pm]);
+    retire_array(reinterpret_cast<const char*>(pm->exchange_header(header)));
+#ifdef YOMM11_NUMA_REPLICAS
+    for (int node = 1; node < nodes; node++) {
+      pm->replicas[node].store(reinterpret_cast<const method_base::header*>(replica_base[node] + header_at[pm]), memory_order_release);
+    }
 #endif
+  }
+
+  if (foreign_size) {
+    get_mm_table<false>::frozen_mask = foreign_size - 1;
+    get_mm_table<false>::frozen.store(
+        reinterpret_cast<const get_mm_table<false>::frozen_class*>(base + foreign_at), memory_order_release);
+  }
+
+  char* previous = arena_memory;
+  size_t previous_mapped = arena_mapped;
+  arena_memory = memory;
+  arena_base = base;
+  arena_size = size;
+  arena_mapped = mapped;
+
+  retire(previous, [](void* p, size_t mapped) { release(static_cast<char*>(p), mapped); }, previous_mapped);
+
+  for (int node = 1; node < YOMM11_MAX_NUMA_NODES; node++) {
+    retire(previous_replicas[node], [](void* p, size_t mapped) { release(static_cast<char*>(p), mapped); }, previous_replicas_mapped[node]);
+  }
+
+}
+
+const size_t work_stealing::chunk_size;
+const size_t work_stealing::min_task;
+int work_stealing::requested;
+
+namespace {
+
+struct work_stealing_run {
+  struct worker {
+    std::mutex mutex;
+    deque<work_stealing::task> tasks;
+  };
+
+  explicit work_stealing_run(int threads) : workers(threads), pending(0), queued(0), failed(false) { }
+
+  bool take(int self, work_stealing::task& t);
+  void work(int self);
+  void wake_all();
+
+  vector<worker> workers;
+  atomic<size_t> pending; // queued or running
+  atomic<size_t> queued;
+  atomic<bool> failed;
+  std::mutex error_mutex;
+  exception_ptr error;
+  // idle workers wait here for a task or for the end of the run
+  std::mutex idle_mutex;
+  condition_variable idle;
+};
+
+// The helper threads, started when a run first needs them and kept for
+// the later runs. Between runs they wait on 'posted', unregistered, so
+// they do not hold back reclamation. One run at a time uses them; a
+// run that starts meanwhile - e.g. from a task - is done by its
+// calling thread alone. Never destroyed: the helpers are detached.
+struct work_stealing_pool {
+  void help();
+
+  std::mutex mutex;
+  condition_variable posted; // a run needs helpers
+  condition_variable left;   // the last helper left the run
+  int threads = 0;
+  work_stealing_run* run = nullptr;
+  uint64_t generation = 0;
+  int wanted = 0;  // helpers the run can use
+  int joined = 0;  // helpers that joined it
+  int active = 0;  // helpers still working on it
+};
+
+// the run and worker that the calling thread belongs to, for spawn()
+thread_local work_stealing_run* current_run;
+thread_local int current_worker;
+
+bool work_stealing_run::take(int self, work_stealing::task& t) {
+  {
+    lock_guard<std::mutex> lock(workers[self].mutex);
+    if (!workers[self].tasks.empty()) {
+      t = move(workers[self].tasks.back());
+      workers[self].tasks.pop_back();
+      queued.fetch_sub(1, memory_order_relaxed);
+      return true;
+    }
+  }
+
+  for (size_t i = 1; i < workers.size(); i++) {
+    auto& victim = workers[(self + i) % workers.size()];
+    lock_guard<std::mutex> lock(victim.mutex);
+    if (!victim.tasks.empty()) {
+      t = move(victim.tasks.front());
+      victim.tasks.pop_front();
+      queued.fetch_sub(1, memory_order_relaxed);
+      return true;
+    }
+  }
+
+  return false;
+}
+
+void work_stealing_run::wake_all() {
+  {
+    // a worker between testing the condition and waiting would miss
+    // the notification
+    lock_guard<std::mutex> lock(idle_mutex);
+  }
+  idle.notify_all();
+}
+
+void work_stealing_run::work(int self) {
+  auto outer_run = current_run;
+  auto outer_worker = current_worker;
+  current_run = this;
+  current_worker = self;
+  work_stealing::task t;
+
+  while (pending.load(memory_order_acquire)) {
+    if (!take(self, t)) {
+      unique_lock<std::mutex> lock(idle_mutex);
+      idle.wait(lock, [this]() {
+          return !pending.load(memory_order_acquire) || queued.load(memory_order_relaxed);
+        });
+      continue;
+    }
+
+    if (!failed.load(memory_order_relaxed)) {
+      try {
+        t();
+      } catch (...) {
+        lock_guard<std::mutex> lock(error_mutex);
+        if (!failed.exchange(true)) {
+          error = current_exception();
+        }
+      }
+    }
+
+    t = nullptr;
+
+    if (pending.fetch_sub(1, memory_order_acq_rel) == 1) {
+      wake_all();
+    }
+
+    if (self) {
+      // a helper holds no dispatch data between tasks
+      quiescent_state();
+    }
+  }
+
+  current_run = outer_run;
+  current_worker = outer_worker;
+}
+
+void work_stealing_pool::help() {
+  uint64_t seen = 0;
+  unique_lock<std::mutex> lock(mutex);
+
+  for (;;) {
+    posted.wait(lock, [&]() { return generation != seen; });
+    seen = generation;
+
+    if (joined == wanted) {
+      continue;
+    }
+
+    auto helped = run;
+    const int self = ++joined;
+    ++active;
+    lock.unlock();
+
+    register_thread();
+    helped->work(self);
+    unregister_thread();
+
+    lock.lock();
+
+    if (!--active) {
+      left.notify_all();
+    }
+  }
+}
+
+}
+
+int work_stealing::threads() {
+  return requested > 0 ? requested : max(1u, thread::hardware_concurrency());
+}
+
+void work_stealing::run(vector<task>& tasks) {
+  work_stealing_run run(threads());
+  run.pending = tasks.size();
+  run.queued = tasks.size();
+
+  // deal the tasks
+  for (size_t i = 0; i < tasks.size(); i++) {
+    run.workers[i % run.workers.size()].tasks.push_back(move(tasks[i]));
+  }
+
+  const int helpers = int(min(run.workers.size(), tasks.size())) - 1;
+  static auto pool = new work_stealing_pool;
+  bool posted = false;
+
+  if (helpers > 0) {
+    lock_guard<std::mutex> lock(pool->mutex);
+
+    if (!pool->run) {
+      for (; pool->threads < helpers; pool->threads++) {
+        thread([]() { pool->help(); }).detach();
+      }
+
+      pool->run = &run;
+      pool->wanted = helpers;
+      pool->joined = 0;
+      ++pool->generation;
+      pool->posted.notify_all();
+      posted = true;
+    }
+  }
+
+  run.work(0);
+
+  if (posted) {
+    // no helper joins from now on; wait for those that did to leave
+    unique_lock<std::mutex> lock(pool->mutex);
+    pool->wanted = pool->joined;
+    pool->left.wait(lock, []() { return !pool->active; });
+    pool->run = nullptr;
+  }
+
+  if (run.error) {
+    rethrow_exception(run.error);
+  }
+}
+
+// Counting sort on the distinct targets, found with a hash table that
+// is twice the size of a chunk. The table is kept by each thread, and
+// only the slots that were used are cleared.
+void work_stealing::bucket(
+    const vector<method_base::void_function_pointer>& targets,
+    vector<uint32_t>& order, vector<uint32_t>& starts) {
+  struct entry {
+    method_base::void_function_pointer target;
+    uint32_t run;
+  };
+
+  thread_local vector<entry> table;
+  thread_local vector<uint32_t> runs, used, next;
+
+  size_t capacity = 16;
+  while (capacity < 2 * targets.size()) {
+    capacity *= 2;
+  }
+
+  if (table.size() < capacity) {
+    table.assign(capacity, entry());
+  }
+
+  const size_t mask = capacity - 1;
+  runs.resize(targets.size());
+  used.clear();
+  starts.assign(1, 0);
+
+  for (size_t i = 0; i < targets.size(); i++) {
+    size_t slot = (reinterpret_cast<uintptr_t>(targets[i]) * 0x9e3779b97f4a7c15ull >> 20) & mask;
+
+    while (table[slot].target && table[slot].target != targets[i]) {
+      slot = (slot + 1) & mask;
+    }
+
+    if (!table[slot].target) {
+      table[slot].target = targets[i];
+      table[slot].run = used.size();
+      used.push_back(slot);
+      starts.push_back(0);
+    }
+
+    runs[i] = table[slot].run;
+    // counts for now
+    ++starts[runs[i] + 1];
+  }
+
+  for (uint32_t slot : used) {
+    table[slot].target = nullptr;
+  }
+
+  for (size_t r = 1; r < starts.size(); r++) {
+    starts[r] += starts[r - 1];
+  }
+
+  order.resize(targets.size());
+  next.assign(starts.begin(), starts.end() - 1);
+
+  for (size_t i = 0; i < targets.size(); i++) {
+    order[next[runs[i]]++] = i;
+  }
+}
+
+void work_stealing::spawn(task t) {
+  if (!current_run) {
+    // not called from a task
+    t();
+    return;
+  }
+
+  current_run->pending.fetch_add(1, memory_order_relaxed);
+  current_run->queued.fetch_add(1, memory_order_relaxed);
+  auto& self = current_run->workers[current_worker];
+
+  {
+    lock_guard<std::mutex> lock(self.mutex);
+    self.tasks.push_back(move(t));
+  }
+
+  current_run->wake_all();
+}
+
+template<class Container>
+static size_t hashed_bytes(const Container* c) {
+  // buckets, plus one node per element holding the value, a link and
+  // the cached hash
+  return c ? sizeof(*c) + c->bucket_count() * sizeof(void*)
+      + c->size() * (sizeof(typename Container::value_type) + 2 * sizeof(void*))
+      : 0;
+}
+
+// For each dimension, the number of groups whose row - the cells that
+// have its index in the dimension - equals the row of an earlier group.
+static vector<int> duplicate_rows(const method_base* pm) {
+  const int dims = pm->vargs.size();
+  vector<int> result(dims, 0);
+  auto header = pm->dispatch.load(memory_order_acquire);
+
+  if (!header || !pm->table_size || int(pm->groups.size()) != dims) {
+    return result;
+  }
+
+  for (int dim = 0; dim < dims; dim++) {
+    const int step = header->slots_and_steps()[2 * dim + 1];
+    const int groups = pm->groups[dim];
+    vector<vector<method_base::dispatch_cell>> rows(groups);
+
+    for (int cell = 0; cell < pm->table_size; cell++) {
+      rows[cell / step % groups].push_back(header->table[cell]);
+    }
+
+    result[dim] = groups - set<vector<method_base::dispatch_cell>>(rows.begin(), rows.end()).size();
+  }
+
+  return result;
+}
+
+memory_statistics memory_stats() {
+  lock_guard<recursive_mutex> lock(registry_mutex());
+  memory_statistics stats = memory_statistics();
+
+  // rows shared by several classes are counted once
+  unordered_set<const yomm11_class::offset*> rows;
+
+  for (yomm11_class* pc = yomm11_class::first; pc; pc = pc->next) {
+    if (rows.insert(pc->mmt.latest()).second) {
+      stats.mmt += pc->mmt.size() * sizeof(yomm11_class::offset);
+    }
+    stats.masks += pc->mask.bytes();
+  }
+
+  for (method_base* pm = method_base::first; pm; pm = pm->next) {
+    method_statistics ms;
+    ms.name = pm->name;
+    ms.method = pm;
+    ms.dimensions = pm->vargs.size();
+    ms.specializations = pm->methods.size();
+    ms.cells = pm->table_size;
+    ms.undefined_cells = pm->undefined_cells;
+    ms.ambiguous_cells = pm->ambiguous_cells;
+    ms.groups = pm->groups;
+    ms.groups.resize(ms.dimensions);
+    ms.duplicate_rows = duplicate_rows(pm);
+    ms.bytes = pm->table_size * sizeof(method_base::dispatch_cell);
+#ifdef YOMM11_COMPACT_DISPATCH
+    if (pm->get_targets()) {
+      ms.bytes += pm->targets_size() * sizeof(method_base::void_function_pointer);
+    }
+#endif
+    stats.dispatch_tables += ms.bytes;
+    stats.specializations += pm->methods.capacity() * sizeof(specialization_base*);
+
+    for (specialization_base* spec : pm->methods) {
+      stats.specializations += pm->specialization_size()
+          + spec->args.capacity() * sizeof(yomm11_class*);
+    }
+
+    stats.methods.push_back(ms);
+  }
+
+  stats.foreign_classes = hashed_bytes(get_mm_table<false>::class_of.load());
+  stats.to_initialize = hashed_bytes(yomm11_class::to_initialize)
+      + hashed_bytes(method_base::to_initialize);
+
+  return stats;
+}
+
+void write_dispatch_report(ostream& os) {
+  const char* method_sep = "\n";
+
+  os << "{\n  \"methods\": [";
+
+  for (auto& ms : memory_stats().methods) {
+    os << method_sep << "    {\n      \"name\": ";
+    write_json_string(os, ms.name);
+    os << ",\n      \"specializations\": " << ms.specializations
+       << ",\n      \"dimensions\": [";
+    method_sep = ",\n";
+
+    for (int dim = 0; dim < ms.dimensions; dim++) {
+      os << (dim ? ", " : " ") << "{ \"groups\": " << ms.groups[dim]
+         << ", \"duplicate_rows\": " << ms.duplicate_rows[dim] << " }";
+    }
+
+    os << " ],\n      \"cells\": " << ms.cells
+       << ",\n      \"undefined\": " << ms.undefined_cells
+       << ",\n      \"ambiguous\": " << ms.ambiguous_cells
+       << ",\n      \"fill_ratio\": " << ms.fill_ratio()
+       << ",\n      \"bytes\": " << ms.bytes
+       << "\n    }";
+  }
+
+  os << "\n  ]\n}\n";
+}
+
+#ifdef YOMM11_ENABLE_PROFILE
+
+std::mutex profile::mutex;
+profile::thread_counters* profile::threads;
+size_t profile::methods;
+
+profile::thread_counters* profile::add_thread() {
+  // kept after the thread exits, so its calls are still reported
+  auto counters = new thread_counters;
+  lock_guard<std::mutex> lock(mutex);
+  counters->next = threads;
+  threads = counters;
+  return counters;
+}
+
+void profile::grow(thread_counters& counters, size_t method, size_t size) {
+  lock_guard<std::mutex> lock(counters.mutex);
+
+  if (counters.methods.size() <= method) {
+    counters.methods.resize(method + 1, cells { nullptr, 0, nullptr, { } });
+  }
+
+  auto& old_cells = counters.methods[method];
+
+  if (size <= old_cells.size) {
+    return;
+  }
+
+  // whole cache lines, so no two threads write to the same line
+  const size_t per_line = arena_builder::cache_line / sizeof(atomic<uint64_t>);
+  size = align(max(size, 2 * old_cells.size), per_line);
+  char* memory = new char[size * sizeof(atomic<uint64_t>) + arena_builder::cache_line];
+  auto counts = reinterpret_cast<atomic<uint64_t>*>(align(reinterpret_cast<size_t>(memory), arena_builder::cache_line));
+
+  for (size_t i = 0; i < size; i++) {
+    new (counts + i) atomic<uint64_t>(i < old_cells.size ? old_cells.counts[i].load(memory_order_relaxed) : 0);
+  }
+
+  delete [] old_cells.memory;
+  old_cells.counts = counts;
+  old_cells.size = size;
+  old_cells.memory = memory;
+  old_cells.folded.resize(size);
+}
+
+namespace {
+
+// Calls f(spec, calls not yet folded) for each cell of the method with
+// a count, over all threads. Holds the locks of the counters.
+template<class F>
+void for_each_count(const method_base* pm, F f) {
+  lock_guard<std::mutex> lock(profile::mutex);
+
+  for (auto counters = profile::threads; counters; counters = counters->next) {
+    lock_guard<std::mutex> counters_lock(counters->mutex);
+
+    if (pm->profile_id >= counters->methods.size()) {
+      continue;
+    }
+
+    auto& cells = counters->methods[pm->profile_id];
+
+    for (size_t i = 0; i < cells.size && i < pm->profile_cells.size(); i++) {
+      const uint64_t count = cells.counts[i].load(memory_order_relaxed);
+      f(pm->profile_cells[i], count - cells.folded[i], cells.folded[i]);
+    }
+  }
+}
+
+uint64_t& calls_of(method_base* pm, specialization_base* spec) {
+  if (spec == &specialization_base::undefined) {
+    return pm->undefined_calls;
+  } else if (spec == &specialization_base::ambiguous) {
+    return pm->ambiguous_calls;
+  }
+  return spec->calls;
+}
+
+}
+
+void profile::fold(method_base* pm) {
+  for_each_count(pm, [=](specialization_base* spec, uint64_t calls, uint64_t& folded) {
+      if (spec) {
+        calls_of(pm, spec) += calls;
+      }
+      folded += calls;
+    });
+}
+
+void reset_profile() {
+  lock_guard<recursive_mutex> lock(registry_mutex());
+
+  for (method_base* pm = method_base::first; pm; pm = pm->next) {
+    for_each_count(pm, [](specialization_base*, uint64_t calls, uint64_t& folded) {
+        folded += calls;
+      });
+
+    pm->undefined_calls = pm->ambiguous_calls = 0;
+
+    for (specialization_base* spec : pm->methods) {
+      spec->calls = 0;
+    }
+  }
+}
+
+void dump_profile(ostream& os) {
+  lock_guard<recursive_mutex> lock(registry_mutex());
+  const char* method_sep = "\n";
+
+  os << "{\n  \"methods\": [";
+
+  for (method_base* pm = method_base::first; pm; pm = pm->next) {
+    // as if the counts were folded now
+    unordered_map<specialization_base*, uint64_t> calls;
+    calls[&specialization_base::undefined] = pm->undefined_calls;
+    calls[&specialization_base::ambiguous] = pm->ambiguous_calls;
+
+    for (specialization_base* spec : pm->methods) {
+      calls[spec] = spec->calls;
+    }
+
+    for_each_count(pm, [&](specialization_base* spec, uint64_t count, uint64_t&) {
+        if (spec) {
+          calls[spec] += count;
+        }
+      });
+
+    uint64_t total = 0;
+
+    for (auto& entry : calls) {
+      total += entry.second;
+    }
+
+    os << method_sep << "    {\n      \"name\": ";
+    write_json_string(os, pm->name);
+    os << ",\n      \"calls\": " << total
+       << ",\n      \"undefined\": " << calls[&specialization_base::undefined]
+       << ",\n      \"ambiguous\": " << calls[&specialization_base::ambiguous]
+       << ",\n      \"specializations\": [";
+    method_sep = ",\n";
+    const char* spec_sep = "\n";
+
+    for (specialization_base* spec : pm->methods) {
+      os << spec_sep << "        { \"classes\": [";
+      spec_sep = ",\n";
+      const char* class_sep = "";
+
+      for (yomm11_class* pc : spec->args) {
+        os << class_sep;
+        class_sep = ", ";
+        write_json_string(os, pc->name);
+      }
+
+      os << "], \"calls\": " << calls[spec] << " }";
+    }
+
+    os << "\n      ]\n    }";
+  }
+
+  os << "\n  ]\n}\n";
+}
+
+#endif
+
+namespace detail {
 
 ostream& operator <<(ostream& os, const bitvec& v) {
   for (int i = 0; i < v.size(); i++) {
@@ -0,0 +1,211 @@
+// benchmarks_arity.cpp
+// Copyright (c) 2013 Jean-Louis Leroy
+// Distributed under the Boost Software License, Version 1.0. (See
+// accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+// Times methods with 1 to 6 virtual arguments, mixed with non-virtual
+// ones: the cost of a call, and of re-computing the dispatch table with
+// initialize(). Each virtual argument takes a node or one of its three
+// subclasses. For each subclass L and each n, a specialization takes L
+// for the first n virtual arguments and node for the others, so each
+// dimension has four groups - the table has 4^arity cells - and there
+// are no ambiguities. See util/bench.hpp for the options.
+
+// ./benchmarks_arity --json benchmarks_arity.json
+
+#include <yorel/multi_methods.hpp>
+
+#include <string>
+
+#include "util/bench.hpp"
+
+using namespace std;
+
+using yorel::multi_methods::selector;
+using yorel::multi_methods::virtual_;
+using bench::do_not_optimize;
+
+struct node : selector {
+  MM_CLASS(node);
+  node() {
+    MM_INIT();
+  }
+};
+
+struct x : node {
+  MM_CLASS(x, node);
+  x() {
+    MM_INIT();
+  }
+};
+
+struct y : node {
+  MM_CLASS(y, node);
+  y() {
+    MM_INIT();
+  }
+};
+
+struct z : node {
+  MM_CLASS(z, node);
+  z() {
+    MM_INIT();
+  }
+};
+
+using V = virtual_<node>&;
+
+MULTI_METHOD(arity1, int, V, int);
+MULTI_METHOD(arity2, int, V, int, V);
+MULTI_METHOD(arity3, int, V, int, V, V);
+MULTI_METHOD(arity4, int, V, int, V, V, V, double);
+MULTI_METHOD(arity5, int, V, int, V, V, V, double, V);
+MULTI_METHOD(arity6, int, V, int, V, V, V, double, V, V);
+
+BEGIN_SPECIALIZATION(arity1, int, node&, int n) {
+  return n;
+} END_SPECIALIZATION;
+
+BEGIN_SPECIALIZATION(arity2, int, node&, int n, node&) {
+  return n;
+} END_SPECIALIZATION;
+
+BEGIN_SPECIALIZATION(arity3, int, node&, int n, node&, node&) {
+  return n;
+} END_SPECIALIZATION;
+
+BEGIN_SPECIALIZATION(arity4, int, node&, int n, node&, node&, node&, double) {
+  return n;
+} END_SPECIALIZATION;
+
+BEGIN_SPECIALIZATION(arity5, int, node&, int n, node&, node&, node&, double, node&) {
+  return n;
+} END_SPECIALIZATION;
+
+BEGIN_SPECIALIZATION(arity6, int, node&, int n, node&, node&, node&, double, node&, node&) {
+  return n;
+} END_SPECIALIZATION;
+
+#define SPEC(ARITY, ...)                                \
+  BEGIN_SPECIALIZATION(ARITY, int, __VA_ARGS__) {       \
+    return 1;                                           \
+  } END_SPECIALIZATION;
+
+#define SPECS(L)                                                        \
+  SPEC(arity1, L&, int)                                                 \
+  SPEC(arity2, L&, int, node&)                                          \
+  SPEC(arity2, L&, int, L&)                                             \
+  SPEC(arity3, L&, int, node&, node&)                                   \
+  SPEC(arity3, L&, int, L&, node&)                                      \
+  SPEC(arity3, L&, int, L&, L&)                                         \
+  SPEC(arity4, L&, int, node&, node&, node&, double)                    \
+  SPEC(arity4, L&, int, L&, node&, node&, double)                       \
+  SPEC(arity4, L&, int, L&, L&, node&, double)                          \
+  SPEC(arity4, L&, int, L&, L&, L&, double)                             \
+  SPEC(arity5, L&, int, node&, node&, node&, double, node&)             \
+  SPEC(arity5, L&, int, L&, node&, node&, double, node&)                \
+  SPEC(arity5, L&, int, L&, L&, node&, double, node&)                   \
+  SPEC(arity5, L&, int, L&, L&, L&, double, node&)                      \
+  SPEC(arity5, L&, int, L&, L&, L&, double, L&)                         \
+  SPEC(arity6, L&, int, node&, node&, node&, double, node&, node&)      \
+  SPEC(arity6, L&, int, L&, node&, node&, double, node&, node&)         \
+  SPEC(arity6, L&, int, L&, L&, node&, double, node&, node&)            \
+  SPEC(arity6, L&, int, L&, L&, L&, double, node&, node&)               \
+  SPEC(arity6, L&, int, L&, L&, L&, double, L&, node&)                  \
+  SPEC(arity6, L&, int, L&, L&, L&, double, L&, L&)
+
+SPECS(x)
+SPECS(y)
+SPECS(z)
+
+namespace {
+
+// times a call, with the deepest specialization, and a re-computation
+// of the dispatch table
+template<class Method>
+void time(bench::runner& runner, int arity, Method& method, const function<void(size_t)>& call) {
+  const string prefix = "arity " + to_string(arity) + ", ";
+
+  if (runner.run(prefix + "call", call)) {
+    for (auto& stats : yorel::multi_methods::memory_stats().methods) {
+      if (stats.method == &method.the()) {
+        runner.counter("specializations", stats.specializations);
+        runner.counter("cells", stats.cells);
+        runner.counter("bytes", stats.bytes);
+      }
+    }
+  }
+
+  // ns per initialize()
+  runner.run(prefix + "initialize", [&](size_t n) {
+      for (size_t i = 0; i < n; i++) {
+        method.the().invalidate();
+        yorel::multi_methods::initialize();
+      }
+    });
+}
+
+}
+
+int main(int argc, char** argv) {
+  yorel::multi_methods::initialize();
+
+  bench::runner runner(argc, argv);
+
+  x object;
+  node plain;
+  node* p = &object;
+
+  if (arity6(*p, 0, *p, *p, *p, 0, *p, *p) != 1 || arity6(*p, 0, *p, *p, *p, 0, *p, plain) != 1
+      || arity6(plain, 0, *p, *p, *p, 0, *p, *p) != 0) {
+    cerr << "wrong dispatch" << endl;
+    return 1;
+  }
+
+  runner.header("virtual arguments");
+
+  time(runner, 1, arity1, [=](size_t n) {
+      for (size_t i = 0; i < n; i++) {
+        do_not_optimize(p);
+        do_not_optimize(arity1(*p, 0));
+      }
+    });
+
+  time(runner, 2, arity2, [=](size_t n) {
+      for (size_t i = 0; i < n; i++) {
+        do_not_optimize(p);
+        do_not_optimize(arity2(*p, 0, *p));
+      }
+    });
+
+  time(runner, 3, arity3, [=](size_t n) {
+      for (size_t i = 0; i < n; i++) {
+        do_not_optimize(p);
+        do_not_optimize(arity3(*p, 0, *p, *p));
+      }
+    });
+
+  time(runner, 4, arity4, [=](size_t n) {
+      for (size_t i = 0; i < n; i++) {
+        do_not_optimize(p);
+        do_not_optimize(arity4(*p, 0, *p, *p, *p, 0));
+      }
+    });
+
+  time(runner, 5, arity5, [=](size_t n) {
+      for (size_t i = 0; i < n; i++) {
+        do_not_optimize(p);
+        do_not_optimize(arity5(*p, 0, *p, *p, *p, 0, *p));
+      }
+    });
+
+  time(runner, 6, arity6, [=](size_t n) {
+      for (size_t i = 0; i < n; i++) {
+        do_not_optimize(p);
+        do_not_optimize(arity6(*p, 0, *p, *p, *p, 0, *p, *p));
+      }
+    });
+
+  return runner.finish();
+}
@@ -0,0 +1,77 @@
+// benchmarks_methods.hpp
+// Copyright (c) 2013 Jean-Louis Leroy
+// Distributed under the Boost Software License, Version 1.0. (See
+// accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+// The multi-methods timed by benchmarks.cpp and throughput.cpp. Include
+// in one translation unit per program: it registers a foreign class.
+
+#include "benchmarks.hpp"
+
+using yorel::multi_methods::virtual_;
+
+namespace intrusive {
+
+MULTI_METHOD(do_nothing, void, virtual_<object>&);
+
+BEGIN_SPECIALIZATION(do_nothing, void, object&) {
+} END_SPECIALIZATION;
+
+MULTI_METHOD(do_something, double, virtual_<object>&, double x, double a, double b, double c);
+
+BEGIN_SPECIALIZATION(do_something, double, object&, double x, double a, double b, double c) {
+  return log(a * x * x + b * x + c);
+} END_SPECIALIZATION;
+
+MULTI_METHOD(do_nothing_2, void, virtual_<object>&, virtual_<object>&);
+
+BEGIN_SPECIALIZATION(do_nothing_2, void, object&, object&) {
+} END_SPECIALIZATION;
+
+}
+
+namespace vbase {
+
+MULTI_METHOD(do_nothing, void, virtual_<object>&);
+
+BEGIN_SPECIALIZATION(do_nothing, void, object&) {
+} END_SPECIALIZATION;
+
+MULTI_METHOD(do_something, double, virtual_<object>&, double x, double a, double b, double c);
+
+BEGIN_SPECIALIZATION(do_something, double, derived&, double x, double a, double b, double c) {
+  return log(a * x * x + b * x + c);
+} END_SPECIALIZATION;
+
+MULTI_METHOD(do_nothing_2, void, virtual_<object>&, virtual_<object>&);
+
+BEGIN_SPECIALIZATION(do_nothing_2, void, object&, object&) {
+} END_SPECIALIZATION;
+
+}
+
+namespace foreign {
+
+struct object {
+  virtual ~object() { }
+};
+
+MM_FOREIGN_CLASS(object);
+
+MULTI_METHOD(do_nothing, void, virtual_<object>&);
+
+BEGIN_SPECIALIZATION(do_nothing, void, object&) {
+} END_SPECIALIZATION;
+
+MULTI_METHOD(do_nothing_2, void, virtual_<object>&, virtual_<object>&);
+
+BEGIN_SPECIALIZATION(do_nothing_2, void, object&, object&) {
+} END_SPECIALIZATION;
+
+MULTI_METHOD(do_something, double, virtual_<object>&, double x, double a, double b, double c);
+
+BEGIN_SPECIALIZATION(do_something, double, object&, double x, double a, double b, double c) {
+  return log(a * x * x + b * x + c);
+} END_SPECIALIZATION;
+}
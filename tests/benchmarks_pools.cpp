@@ -0,0 +1,224 @@
+// benchmarks_pools.cpp
+// Copyright (c) 2013 Jean-Louis Leroy
+// Distributed under the Boost Software License, Version 1.0. (See
+// accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+// Times calls on a shuffled pool of objects of 100 classes, instead of
+// on the same object over and over, so the dispatch data competes with
+// the objects for the caches and the branch predictor cannot guess the
+// target. The pools are sized to fit in half of L1, L2 and L3, and to
+// overflow L3 - the cache sizes are read from the system when possible.
+// Each scenario is timed with a virtual function, and with open methods
+// on intrusive and foreign classes. See util/bench.hpp for the options.
+
+// ./benchmarks_pools --json benchmarks_pools.json
+
+#include <yorel/multi_methods.hpp>
+
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#ifdef __linux__
+#include <unistd.h>
+#endif
+
+#include "util/bench.hpp"
+#include "util/factories.hpp"
+
+using namespace std;
+
+using yorel::multi_methods::selector;
+using yorel::multi_methods::virtual_;
+using bench::do_not_optimize;
+
+// about one cache line per object
+struct intrusive_base : selector {
+  MM_CLASS(intrusive_base);
+  intrusive_base() : value(0) {
+    MM_INIT();
+  }
+  virtual ~intrusive_base() { }
+  virtual void visit() = 0;
+  long value;
+  char pad[32];
+};
+
+struct foreign_base {
+  foreign_base() : value(0) { }
+  virtual ~foreign_base() { }
+  long value;
+  char pad[40];
+};
+
+MM_FOREIGN_CLASS(foreign_base);
+
+MULTI_METHOD(visit_intrusive, void, virtual_<intrusive_base>&);
+MULTI_METHOD(visit_foreign, void, virtual_<foreign_base>&);
+
+namespace {
+
+struct factory {
+  function<intrusive_base*()> intrusive;
+  function<foreign_base*()> foreign;
+};
+
+}
+
+#define CLASS(N)                                                        \
+  struct intrusive ## N : intrusive_base {                              \
+    MM_CLASS(intrusive ## N, intrusive_base);                           \
+    intrusive ## N() {                                                  \
+      MM_INIT();                                                        \
+    }                                                                   \
+    virtual void visit() {                                              \
+      value += 1 ## N;                                                  \
+    }                                                                   \
+  };                                                                    \
+  BEGIN_SPECIALIZATION(visit_intrusive, void, intrusive ## N& object) { \
+    object.value += 1 ## N;                                             \
+  } END_SPECIALIZATION;                                                 \
+  struct foreign ## N : foreign_base { };                               \
+  MM_FOREIGN_CLASS(foreign ## N, foreign_base);                         \
+  BEGIN_SPECIALIZATION(visit_foreign, void, foreign ## N& object) {     \
+    object.value += 1 ## N;                                             \
+  } END_SPECIALIZATION;                                                 \
+  ADD_FACTORY(factory, N, factory {                                     \
+      []() -> intrusive_base* { return new intrusive ## N; },           \
+      []() -> foreign_base* { return new foreign ## N; } });
+
+#define CLASSES_10(N) \
+  CLASS(N ## 0) CLASS(N ## 1) CLASS(N ## 2) CLASS(N ## 3) CLASS(N ## 4) \
+  CLASS(N ## 5) CLASS(N ## 6) CLASS(N ## 7) CLASS(N ## 8) CLASS(N ## 9)
+
+CLASSES_10(0)
+CLASSES_10(1)
+CLASSES_10(2)
+CLASSES_10(3)
+CLASSES_10(4)
+CLASSES_10(5)
+CLASSES_10(6)
+CLASSES_10(7)
+CLASSES_10(8)
+CLASSES_10(9)
+
+namespace {
+
+size_t cache_size(int level) {
+  static const size_t defaults[] = { 32 << 10, 1 << 20, 32 << 20 };
+  long size = 0;
+#if defined(__linux__) && defined(_SC_LEVEL1_DCACHE_SIZE)
+  static const int names[] = { _SC_LEVEL1_DCACHE_SIZE, _SC_LEVEL2_CACHE_SIZE, _SC_LEVEL3_CACHE_SIZE };
+  size = sysconf(names[level - 1]);
+#endif
+  return size > 0 ? size_t(size) : defaults[level - 1];
+}
+
+// a pointer and an object of each kind, per entry
+const size_t entry_size = sizeof(void*) + max(sizeof(intrusive_base), sizeof(foreign_base));
+
+template<class Object>
+struct pool {
+  pool(size_t count, function<Object*(const factory&)> make) {
+    mt19937 random;
+    objects.reserve(count);
+
+    for (size_t i = 0; i < count; i++) {
+      objects.emplace_back(make(factories<factory>()[random() % factories<factory>().size()]));
+    }
+
+    // objects of the same class are not next to each other in memory,
+    // and are visited in a different order than they were allocated
+    shuffle(objects.begin(), objects.end(), random);
+
+    for (auto& object : objects) {
+      pointers.push_back(object.get());
+    }
+  }
+
+  vector<unique_ptr<Object>> objects;
+  vector<Object*> pointers;
+};
+
+// calls 'visit' on the objects of the pool, in order, wrapping around
+template<class Object, class Visit>
+function<void(size_t)> visitor(const pool<Object>& objects, Visit visit) {
+  Object* const* pointers = objects.pointers.data();
+  const size_t size = objects.pointers.size();
+
+  return [=](size_t n) {
+    size_t j = 0;
+
+    for (size_t i = 0; i < n; i++) {
+      Object* object = pointers[j];
+      do_not_optimize(object);
+      visit(*object);
+
+      if (++j == size) {
+        j = 0;
+      }
+    }
+  };
+}
+
+}
+
+int main(int argc, char** argv) {
+  yorel::multi_methods::initialize();
+
+  bench::runner runner(argc, argv);
+
+  runner.context("classes", to_string(factories<factory>().size()));
+
+  struct working_set {
+    const char* name;
+    size_t bytes;
+  };
+
+  const working_set working_sets[] = {
+    { "L1", cache_size(1) / 2 },
+    { "L2", cache_size(2) / 2 },
+    { "L3", cache_size(3) / 2 },
+    { "DRAM", max(size_t(64) << 20, cache_size(3) * 4) },
+  };
+
+  runner.header("shuffled pools of " + to_string(factories<factory>().size()) + " classes");
+
+  for (auto& ws : working_sets) {
+    const size_t count = max(factories<factory>().size(), ws.bytes / entry_size);
+    const string prefix = string("pool ") + ws.name + ", ";
+
+    auto time = [&](const string& scenario, const function<void(size_t)>& body) {
+      if (runner.run(prefix + scenario, body)) {
+        runner.counter("objects", count);
+        runner.counter("bytes", ws.bytes);
+      }
+    };
+
+    if (runner.selected(prefix + "virtual function") || runner.selected(prefix + "open method, intrusive")) {
+      pool<intrusive_base> intrusive(count, [](const factory& f) { return f.intrusive(); });
+
+      time("virtual function", visitor(intrusive, [](intrusive_base& object) {
+            object.visit();
+          }));
+
+      time("open method, intrusive", visitor(intrusive, [](intrusive_base& object) {
+            visit_intrusive(object);
+          }));
+    }
+
+    if (runner.selected(prefix + "open method, foreign")) {
+      pool<foreign_base> foreign(count, [](const factory& f) { return f.foreign(); });
+
+      time("open method, foreign", visitor(foreign, [](foreign_base& object) {
+            visit_foreign(object);
+          }));
+    }
+  }
+
+  return runner.finish();
+}
@@ -0,0 +1,264 @@
+// benchmarks_shapes.cpp
+// Copyright (c) 2013 Jean-Louis Leroy
+// Distributed under the Boost Software License, Version 1.0. (See
+// accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+// Times calls and initialize() on hierarchies of different shapes:
+//
+//   chain   - 25 classes, each derived from the previous one
+//   fan     - a root and 100 direct subclasses
+//   diamond - 8 diamonds stacked on top of each other: two classes
+//             derive virtually from the bottom of the previous diamond,
+//             and the bottom of the next one derives from both
+//   lattice - like tests/mi.hpp: 6 traits derived virtually from the
+//             root, and a class for each pair of traits
+//
+// Each shape has a unary and a binary method, specialized for each
+// class - on both arguments for the binary one. A call scenario calls
+// both methods on one object of each class in turn; it records the
+// number of classes, the width of the mm table of the most derived
+// class, and the cells and bytes of the dispatch tables. See
+// util/bench.hpp for the options.
+
+// ./benchmarks_shapes --json benchmarks_shapes.json
+
+#include <yorel/multi_methods.hpp>
+#include <yorel/methods/runtime.hpp>
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "util/bench.hpp"
+#include "util/factories.hpp"
+
+using namespace std;
+
+using yorel::multi_methods::selector;
+using yorel::multi_methods::virtual_;
+using bench::do_not_optimize;
+
+#define SPECIALIZE(SHAPE, CLASS, N)                                     \
+  BEGIN_SPECIALIZATION(SHAPE ## _unary, int, CLASS&) {                  \
+    return N;                                                           \
+  } END_SPECIALIZATION;                                                 \
+  BEGIN_SPECIALIZATION(SHAPE ## _binary, int, CLASS&, CLASS&) {         \
+    return N;                                                           \
+  } END_SPECIALIZATION;                                                 \
+  ADD_FACTORY(function<SHAPE*()>, CLASS, []() -> SHAPE* { return new CLASS; });
+
+#define SHAPE(ROOT)                                                     \
+  struct ROOT : selector {                                              \
+    MM_CLASS(ROOT);                                                     \
+    ROOT() {                                                            \
+      MM_INIT();                                                        \
+    }                                                                   \
+    virtual ~ROOT() { }                                                 \
+  };                                                                    \
+  MULTI_METHOD(ROOT ## _unary, int, virtual_<ROOT>&);                   \
+  MULTI_METHOD(ROOT ## _binary, int, virtual_<ROOT>&, virtual_<ROOT>&); \
+  SPECIALIZE(ROOT, ROOT, 0)
+
+// chain
+
+SHAPE(chain)
+
+#define CHAIN(N, BASE)                                                  \
+  struct chain ## N : BASE {                                            \
+    MM_CLASS(chain ## N, BASE);                                         \
+    chain ## N() {                                                      \
+      MM_INIT();                                                        \
+    }                                                                   \
+  };                                                                    \
+  SPECIALIZE(chain, chain ## N, N)
+
+CHAIN(1, chain) CHAIN(2, chain1) CHAIN(3, chain2) CHAIN(4, chain3)
+CHAIN(5, chain4) CHAIN(6, chain5) CHAIN(7, chain6) CHAIN(8, chain7)
+CHAIN(9, chain8) CHAIN(10, chain9) CHAIN(11, chain10) CHAIN(12, chain11)
+CHAIN(13, chain12) CHAIN(14, chain13) CHAIN(15, chain14) CHAIN(16, chain15)
+CHAIN(17, chain16) CHAIN(18, chain17) CHAIN(19, chain18) CHAIN(20, chain19)
+CHAIN(21, chain20) CHAIN(22, chain21) CHAIN(23, chain22) CHAIN(24, chain23)
+
+using chain_leaf = chain24;
+
+// fan
+
+SHAPE(fan)
+
+#define FAN(N)                                                          \
+  struct fan ## N : fan {                                               \
+    MM_CLASS(fan ## N, fan);                                            \
+    fan ## N() {                                                        \
+      MM_INIT();                                                        \
+    }                                                                   \
+  };                                                                    \
+  SPECIALIZE(fan, fan ## N, 1 ## N)
+
+#define FANS_10(N) \
+  FAN(N ## 0) FAN(N ## 1) FAN(N ## 2) FAN(N ## 3) FAN(N ## 4) \
+  FAN(N ## 5) FAN(N ## 6) FAN(N ## 7) FAN(N ## 8) FAN(N ## 9)
+
+FANS_10(0) FANS_10(1) FANS_10(2) FANS_10(3) FANS_10(4)
+FANS_10(5) FANS_10(6) FANS_10(7) FANS_10(8) FANS_10(9)
+
+using fan_leaf = fan99;
+
+// diamond
+
+SHAPE(diamond)
+
+#define DIAMOND(N, BASE)                                                \
+  struct diamond_left ## N : virtual BASE {                             \
+    MM_CLASS(diamond_left ## N, BASE);                                  \
+    diamond_left ## N() {                                               \
+      MM_INIT();                                                        \
+    }                                                                   \
+  };                                                                    \
+  SPECIALIZE(diamond, diamond_left ## N, N * 3 + 1)                     \
+  struct diamond_right ## N : virtual BASE {                            \
+    MM_CLASS(diamond_right ## N, BASE);                                 \
+    diamond_right ## N() {                                              \
+      MM_INIT();                                                        \
+    }                                                                   \
+  };                                                                    \
+  SPECIALIZE(diamond, diamond_right ## N, N * 3 + 2)                    \
+  struct diamond ## N : diamond_left ## N, diamond_right ## N {         \
+    MM_CLASS(diamond ## N, diamond_left ## N, diamond_right ## N);      \
+    diamond ## N() {                                                    \
+      MM_INIT();                                                        \
+    }                                                                   \
+  };                                                                    \
+  SPECIALIZE(diamond, diamond ## N, N * 3 + 3)
+
+DIAMOND(1, diamond) DIAMOND(2, diamond1) DIAMOND(3, diamond2) DIAMOND(4, diamond3)
+DIAMOND(5, diamond4) DIAMOND(6, diamond5) DIAMOND(7, diamond6) DIAMOND(8, diamond7)
+
+using diamond_leaf = diamond8;
+
+// lattice
+
+SHAPE(lattice)
+
+#define TRAIT(N)                                                        \
+  struct trait ## N : virtual lattice {                                 \
+    MM_CLASS(trait ## N, lattice);                                      \
+    trait ## N() {                                                      \
+      MM_INIT();                                                        \
+    }                                                                   \
+  };                                                                    \
+  SPECIALIZE(lattice, trait ## N, N)
+
+TRAIT(1) TRAIT(2) TRAIT(3) TRAIT(4) TRAIT(5) TRAIT(6)
+
+#define PAIR(I, J)                                                      \
+  struct pair ## I ## J : trait ## I, trait ## J {                      \
+    MM_CLASS(pair ## I ## J, trait ## I, trait ## J);                   \
+    pair ## I ## J() {                                                  \
+      MM_INIT();                                                        \
+    }                                                                   \
+  };                                                                    \
+  SPECIALIZE(lattice, pair ## I ## J, I ## J)
+
+PAIR(1, 2) PAIR(1, 3) PAIR(1, 4) PAIR(1, 5) PAIR(1, 6)
+PAIR(2, 3) PAIR(2, 4) PAIR(2, 5) PAIR(2, 6)
+PAIR(3, 4) PAIR(3, 5) PAIR(3, 6)
+PAIR(4, 5) PAIR(4, 6)
+PAIR(5, 6)
+
+using lattice_leaf = pair56;
+
+namespace {
+
+template<class Method>
+void table_counters(bench::runner& runner, const string& prefix, Method& method) {
+  for (auto& stats : yorel::multi_methods::memory_stats().methods) {
+    if (stats.method == &method.the()) {
+      runner.counter(prefix + " cells", stats.cells);
+      runner.counter(prefix + " bytes", stats.bytes);
+    }
+  }
+}
+
+template<class Root, class Leaf, class Unary, class Binary>
+void time(bench::runner& runner, const string& shape,
+          const vector<function<Root*()>>& factories, Unary& unary, Binary& binary) {
+  using namespace yorel::methods::detail;
+
+  vector<unique_ptr<Root>> objects;
+  vector<Root*> pointers;
+
+  for (auto& make : factories) {
+    objects.emplace_back(make());
+    pointers.push_back(objects.back().get());
+  }
+
+  Root* const* first = pointers.data();
+  const size_t size = pointers.size();
+
+  auto scenario = [=](size_t n) {
+    size_t j = 0;
+
+    for (size_t i = 0; i < n; i++) {
+      Root* object = first[j];
+      do_not_optimize(object);
+      do_not_optimize(unary(*object));
+      do_not_optimize(binary(*object, *object));
+
+      if (++j == size) {
+        j = 0;
+      }
+    }
+  };
+
+  // ns per pair of calls
+  if (runner.run(shape + ", unary and binary calls", scenario)) {
+    runner.counter("classes", size);
+    runner.counter("mmt width", yomm11_class::of<Leaf>::the().mmt.n);
+    table_counters(runner, "unary", unary);
+    table_counters(runner, "binary", binary);
+  }
+
+  // ns per initialize()
+  runner.run(shape + ", initialize", [&](size_t n) {
+      for (size_t i = 0; i < n; i++) {
+        yomm11_class::add_to_initialize(&yomm11_class::of<Root>::the());
+        unary.the().invalidate();
+        binary.the().invalidate();
+        yorel::multi_methods::initialize();
+      }
+    });
+}
+
+}
+
+int main(int argc, char** argv) {
+  yorel::multi_methods::initialize();
+
+  bench::runner runner(argc, argv);
+
+  {
+    chain24 c24;
+    chain12 c12;
+    diamond8 d8;
+    pair56 p56;
+    trait3 t3;
+
+    if (chain_unary(c24) != 24 || chain_binary(c24, c12) != 12
+        || diamond_unary(d8) != 27 || lattice_unary(p56) != 56
+        || lattice_binary(p56, t3) != 0) {
+      cerr << "wrong dispatch" << endl;
+      return 1;
+    }
+  }
+
+  runner.header("hierarchy shapes");
+
+  time<chain, chain_leaf>(runner, "chain", factories<function<chain*()>>(), chain_unary, chain_binary);
+  time<fan, fan_leaf>(runner, "fan", factories<function<fan*()>>(), fan_unary, fan_binary);
+  time<diamond, diamond_leaf>(runner, "diamond", factories<function<diamond*()>>(), diamond_unary, diamond_binary);
+  time<lattice, lattice_leaf>(runner, "lattice", factories<function<lattice*()>>(), lattice_unary, lattice_binary);
+
+  return runner.finish();
+}
@@ -0,0 +1,175 @@
+// compile_time.cpp
+// Copyright (c) 2013 Jean-Louis Leroy
+// Distributed under the Boost Software License, Version 1.0. (See
+// accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+// Times the compilation of generated translation units that declare N
+// methods with M specializations each, under each compiler found by
+// cmake - g++ and clang++. The methods take V virtual arguments and N
+// non-virtual ones - two and one, or six and two for the arity
+// scenario - the specializations take a different subclass of the root
+// for the first one, and the TU calls each method once, so the
+// scenarios exercise the extraction of the virtual parameters and the
+// computation of the cell, not only the registration. The sources
+// are written to the build directory and compiled with -O0 -c. A
+// compilation takes seconds, so use few repetitions. See util/bench.hpp
+// for the options.
+
+// ./compile_time --repetitions 3 --warmup 0 --json compile_time.json
+
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "util/bench.hpp"
+
+using namespace std;
+
+namespace {
+
+struct compiler {
+  string name;
+  string path;
+};
+
+// writes the TU; returns its number of lines
+int generate(const string& path, int methods, int specializations,
+             int virtuals, int non_virtuals) {
+  ofstream out(path);
+  int lines = 0;
+
+  auto line = [&](const string& text) {
+    out << text << "\n";
+    ++lines;
+  };
+
+  line("#include <yorel/multi_methods.hpp>");
+  line("using yorel::multi_methods::selector;");
+  line("using yorel::multi_methods::virtual_;");
+  line("struct root : selector { MM_CLASS(root); root() { MM_INIT(); } };");
+
+  for (int s = 0; s < specializations; s++) {
+    const string leaf = "leaf" + to_string(s);
+    line("struct " + leaf + " : root { MM_CLASS(" + leaf + ", root); "
+         + leaf + "() { MM_INIT(); } };");
+  }
+
+  // the first virtual argument, the non-virtual ones, then the other
+  // virtual ones
+  string virtual_parameters = "virtual_<root>&";
+  string parameters = "";
+  string arguments = "a";
+
+  for (int i = 0; i < non_virtuals; i++) {
+    virtual_parameters += ", int";
+    parameters += ", int n" + to_string(i);
+    arguments += ", " + to_string(i);
+  }
+
+  for (int i = 1; i < virtuals; i++) {
+    virtual_parameters += ", const virtual_<root>&";
+    parameters += ", const root&";
+    arguments += ", b";
+  }
+
+  const string result = non_virtuals ? "n0" : "0";
+
+  for (int m = 0; m < methods; m++) {
+    const string method = "method" + to_string(m);
+    line("MULTI_METHOD(" + method + ", int, " + virtual_parameters + ");");
+
+    for (int s = 0; s < specializations; s++) {
+      line("BEGIN_SPECIALIZATION(" + method + ", int, leaf" + to_string(s)
+           + "&" + parameters + ") { return " + result + "; } END_SPECIALIZATION;");
+    }
+
+    line("int call" + to_string(m) + "(root& a, const root& b) { return "
+         + method + "(" + arguments + "); }");
+  }
+
+  return lines;
+}
+
+}
+
+int main(int argc, char** argv) {
+  bench::runner runner(argc, argv);
+
+  vector<compiler> compilers;
+
+  if (*YOMM11_GXX) {
+    compilers.push_back(compiler { "g++", YOMM11_GXX });
+  }
+
+  if (*YOMM11_CLANGXX) {
+    compilers.push_back(compiler { "clang++", YOMM11_CLANGXX });
+  }
+
+  for (auto& c : compilers) {
+    runner.context(c.name, c.path);
+  }
+
+  struct size {
+    int methods;
+    int specializations;
+    int virtuals;
+    int non_virtuals;
+  };
+
+  // the first one is the cost of the header
+  const size sizes[] = {
+    { 1, 1, 2, 1 },
+    { 10, 10, 2, 1 },
+    { 40, 10, 2, 1 },
+    { 10, 40, 2, 1 },
+    { 10, 10, 6, 2 },
+  };
+
+  runner.header("compile time");
+
+  int status = 0;
+
+  for (auto& c : compilers) {
+    for (auto& s : sizes) {
+      const string scenario = c.name + ", " + to_string(s.methods) + " methods x "
+        + to_string(s.specializations) + " specializations, "
+        + to_string(s.virtuals) + "+" + to_string(s.non_virtuals) + " arguments";
+
+      if (!runner.selected(scenario)) {
+        continue;
+      }
+
+      const string stem = string(YOMM11_COMPILE_TIME_DIR) + "/compile_time_"
+        + to_string(s.methods) + "_" + to_string(s.specializations) + "_"
+        + to_string(s.virtuals) + "_" + to_string(s.non_virtuals);
+      const int lines = generate(stem + ".cpp", s.methods, s.specializations,
+                                 s.virtuals, s.non_virtuals);
+      const string command = "\"" + c.path + "\" -std=c++11 -O0 -I\"" YOMM11_INCLUDE_DIR "\" -c \""
+        + stem + ".cpp\" -o \"" + stem + "_" + c.name + ".o\"";
+
+      if (system(command.c_str()) != 0) {
+        cerr << "failed: " << command << endl;
+        status = 1;
+        continue;
+      }
+
+      // ns per compilation
+      runner.run(scenario, [&](size_t n) {
+          for (size_t i = 0; i < n; i++) {
+            if (system(command.c_str()) != 0) {
+              status = 1;
+            }
+          }
+        });
+
+      runner.counter("methods", s.methods);
+      runner.counter("specializations", s.methods * s.specializations);
+      runner.counter("virtual arguments", s.virtuals);
+      runner.counter("lines", lines);
+    }
+  }
+
+  return runner.finish() || status;
+}
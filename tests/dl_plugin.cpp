@@ -0,0 +1,60 @@
+// dl_plugin.cpp
+// Copyright (c) 2013 Jean-Louis Leroy
+// Distributed under the Boost Software License, Version 1.0. (See
+// accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+// Built several times, with a different PLUGIN_ID each time. Each copy
+// adds a class, a specialization of 'encounter' and a multi-method of
+// its own.
+
+#include "dl_stress.hpp"
+
+using yorel::multi_methods::virtual_;
+
+#define CAT(A, B) CAT_(A, B)
+#define CAT_(A, B) A ## B
+#define Predator CAT(Predator, PLUGIN_ID)
+// gcc gives the statics of method<> instantiated on a template from an
+// anonymous namespace vague linkage, so each copy needs a namespace of
+// its own
+#define this_plugin CAT(plugin, PLUGIN_ID)
+
+struct Predator : Carnivore {
+  MM_CLASS(Predator, Carnivore);
+  Predator() {
+    MM_INIT();
+  }
+};
+
+BEGIN_SPECIALIZATION(encounter, std::string, const Predator&, const Herbivore&) {
+  return "hunt " + std::to_string(PLUGIN_ID);
+} END_SPECIALIZATION;
+
+namespace this_plugin {
+
+MULTI_METHOD(kind, std::string, const virtual_<Animal>&);
+
+BEGIN_SPECIALIZATION(kind, std::string, const Animal&) {
+  return "animal";
+} END_SPECIALIZATION;
+
+BEGIN_SPECIALIZATION(kind, std::string, const Predator&) {
+  return "predator " + std::to_string(PLUGIN_ID);
+} END_SPECIALIZATION;
+
+Animal* make_predator() {
+  return new Predator;
+}
+
+std::string call_kind(const Animal& animal) {
+  return kind(animal);
+}
+
+const plugin the_plugin = { PLUGIN_ID, make_predator, call_kind };
+
+}
+
+extern "C" const plugin* get_plugin() {
+  return &this_plugin::the_plugin;
+}
@@ -0,0 +1,117 @@
+// dl_stress.cpp
+// Copyright (c) 2013 Jean-Louis Leroy
+// Distributed under the Boost Software License, Version 1.0. (See
+// accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+// Loads copies of the same plugin from several threads at once. Each
+// thread calls initialize() - or initialize_async() for every other
+// thread - and dispatches as soon as its plugin is loaded, while the
+// other threads are still loading theirs. At the end all the plugins
+// must be registered.
+
+#include "dl_stress.hpp"
+
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <future>
+#include <chrono>
+#include <vector>
+#include <dlfcn.h>
+
+using namespace std;
+using yorel::multi_methods::virtual_;
+
+BEGIN_SPECIALIZATION(encounter, string, const Animal&, const Animal&) {
+  return "ignore";
+} END_SPECIALIZATION;
+
+BEGIN_SPECIALIZATION(encounter, string, const Herbivore&, const Carnivore&) {
+  return "run";
+} END_SPECIALIZATION;
+
+const int plugins = 8;
+atomic<int> failures(0);
+
+void check(int id, const string& what, const string& got, const string& expected) {
+  if (got != expected) {
+    cerr << "plugin " << id << ": " << what << " returns \"" << got
+         << "\", expected \"" << expected << "\"\n";
+    ++failures;
+  }
+}
+
+void check(const plugin* p) {
+  Cow cow;
+  unique_ptr<Animal> predator(p->make_predator());
+  check(p->id, "encounter(predator, cow)", encounter(*predator, cow), "hunt " + to_string(p->id));
+  check(p->id, "encounter(cow, predator)", encounter(cow, *predator), "run");
+  check(p->id, "kind(predator)", p->kind(*predator), "predator " + to_string(p->id));
+  check(p->id, "kind(cow)", p->kind(cow), "animal");
+}
+
+int main(int argc, char** argv) {
+  const string dir = argc > 1 ? argv[1] : ".";
+
+  yorel::multi_methods::initialize();
+
+  vector<const plugin*> loaded(plugins);
+  vector<thread> loaders;
+
+  for (int id = 1; id <= plugins; id++) {
+    loaders.push_back(thread([&, id]() {
+          yorel::multi_methods::register_thread();
+          string path = dir + "/libdl_plugin" + to_string(id) + ".so";
+          void* handle = dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+
+          if (!handle) {
+            cerr << "dlopen() failed: " << dlerror() << "\n";
+            ++failures;
+          } else {
+            auto get_plugin = reinterpret_cast<get_plugin_type>(dlsym(handle, "get_plugin"));
+
+            if (id % 2) {
+              yorel::multi_methods::initialize();
+            } else {
+              auto ready = yorel::multi_methods::initialize_async();
+              Cow cow;
+
+              while (ready.wait_for(chrono::seconds(0)) != future_status::ready) {
+                check(id, "encounter(cow, cow)", encounter(cow, cow), "ignore");
+                yorel::multi_methods::quiescent_state();
+              }
+
+              ready.get();
+            }
+
+            loaded[id - 1] = get_plugin();
+            check(loaded[id - 1]);
+          }
+
+          yorel::multi_methods::quiescent_state();
+          yorel::multi_methods::unregister_thread();
+        }));
+  }
+
+  for (auto& loader : loaders) {
+    loader.join();
+  }
+
+  yorel::multi_methods::initialize();
+
+  for (auto p : loaded) {
+    if (p) {
+      check(p);
+    }
+  }
+
+  Cow cow;
+  check(0, "encounter(cow, cow)", encounter(cow, cow), "ignore");
+
+  cout << plugins << " plugins loaded concurrently, "
+       << failures << " failures\n";
+
+  return failures ? 1 : 0;
+}
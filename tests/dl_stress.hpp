@@ -0,0 +1,56 @@
+// dl_stress.hpp
+// Copyright (c) 2013 Jean-Louis Leroy
+// Distributed under the Boost Software License, Version 1.0. (See
+// accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+// Shared by dl_stress and the plugins it loads.
+
+#ifndef DL_STRESS_DEFINED
+#define DL_STRESS_DEFINED
+
+#include <string>
+
+#include <yorel/multi_methods.hpp>
+
+struct Animal : yorel::multi_methods::selector {
+  MM_CLASS(Animal);
+  Animal() {
+    MM_INIT();
+  }
+  virtual ~Animal() { }
+};
+
+struct Herbivore : Animal {
+  MM_CLASS(Herbivore, Animal);
+  Herbivore() {
+    MM_INIT();
+  }
+};
+
+struct Carnivore : Animal {
+  MM_CLASS(Carnivore, Animal);
+  Carnivore() {
+    MM_INIT();
+  }
+};
+
+struct Cow : Herbivore {
+  MM_CLASS(Cow, Herbivore);
+  Cow() {
+    MM_INIT();
+  }
+};
+
+MULTI_METHOD(encounter, std::string, const yorel::multi_methods::virtual_<Animal>&, const yorel::multi_methods::virtual_<Animal>&);
+
+// what a plugin exports, through 'get_plugin'
+struct plugin {
+  int id;
+  Animal* (*make_predator)();
+  std::string (*kind)(const Animal&);
+};
+
+using get_plugin_type = const plugin* (*)();
+
+#endif
@@ -0,0 +1,117 @@
+// dl_unload.cpp
+// Copyright (c) 2013 Jean-Louis Leroy
+// Distributed under the Boost Software License, Version 1.0. (See
+// accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+// Loads and unloads two libraries, calling initialize() after each
+// step: one adds a leaf class and a specialization to the hierarchy of
+// the program, the other one brings a hierarchy of its own - root
+// included - and a method rooted in it.
+
+#include "dl_stress.hpp"
+
+#include <yorel/methods/runtime.hpp>
+
+#include <iostream>
+#include <memory>
+#include <string>
+#include <cstring>
+#include <dlfcn.h>
+
+using namespace std;
+using yorel::multi_methods::virtual_;
+using yorel::methods::detail::yomm11_class;
+using yorel::methods::detail::method_base;
+
+namespace {
+
+int failed;
+
+#define check(expr)                                             \
+  if (!(expr)) {                                                \
+    cerr << __FILE__ << ":" << __LINE__ << ": " << #expr << endl; \
+    ++failed;                                                   \
+  }
+
+int specializations_of_encounter() {
+  for (auto& ms : yorel::multi_methods::memory_stats().methods) {
+    if (ms.method == encounter.impl) {
+      return ms.specializations;
+    }
+  }
+
+  return -1;
+}
+
+bool nothing_to_initialize() {
+  return !yomm11_class::to_initialize && !method_base::to_initialize;
+}
+
+}
+
+BEGIN_SPECIALIZATION(encounter, string, const Animal&, const Animal&) {
+  return "ignore";
+} END_SPECIALIZATION;
+
+BEGIN_SPECIALIZATION(encounter, string, const Herbivore&, const Carnivore&) {
+  return "run";
+} END_SPECIALIZATION;
+
+int main(int argc, char** argv) {
+  const string dir = argc > 1 ? argv[1] : ".";
+#ifdef __APPLE__
+  const string suffix = ".dylib";
+#else
+  const string suffix = ".so";
+#endif
+
+  yorel::multi_methods::initialize();
+  const int specializations = specializations_of_encounter();
+  Cow cow;
+  Carnivore carnivore;
+
+  for (int cycle = 0; cycle < 3; cycle++) {
+    void* leaf = dlopen((dir + "/libdl_unload_leaf" + suffix).c_str(), RTLD_NOW | RTLD_LOCAL);
+
+    if (!leaf) {
+      cerr << "dlopen() failed: " << dlerror() << endl;
+      return 1;
+    }
+
+    yorel::multi_methods::initialize();
+    check(specializations_of_encounter() == specializations + 1);
+    auto make_mule = reinterpret_cast<Animal* (*)()>(dlsym(leaf, "make_mule"));
+    unique_ptr<Animal> mule(make_mule());
+    check(encounter(*mule, carnivore) == "kick");
+    check(encounter(cow, carnivore) == "run");
+    mule.reset();
+
+    dlclose(leaf);
+    check(specializations_of_encounter() == specializations);
+    yorel::multi_methods::initialize();
+    check(nothing_to_initialize());
+    check(encounter(cow, carnivore) == "run");
+    check(encounter(carnivore, cow) == "ignore");
+
+    void* root = dlopen((dir + "/libdl_unload_root" + suffix).c_str(), RTLD_NOW | RTLD_LOCAL);
+
+    if (!root) {
+      cerr << "dlopen() failed: " << dlerror() << endl;
+      return 1;
+    }
+
+    yorel::multi_methods::initialize();
+    auto grow_plants = reinterpret_cast<const char* (*)()>(dlsym(root, "grow_plants"));
+    check(string(grow_plants()) == "oak tree plant");
+
+    dlclose(root);
+    yorel::multi_methods::initialize();
+    check(nothing_to_initialize());
+    check(encounter(cow, carnivore) == "run");
+  }
+
+  cout << (failed ? "failed" : "passed") << endl;
+
+  return failed ? 1 : 0;
+}
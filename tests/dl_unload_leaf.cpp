@@ -0,0 +1,25 @@
+// dl_unload_leaf.cpp
+// Copyright (c) 2013 Jean-Louis Leroy
+// Distributed under the Boost Software License, Version 1.0. (See
+// accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+// Loaded and unloaded by dl_unload: a leaf class with a specialization
+// of its own.
+
+#include "dl_stress.hpp"
+
+struct Mule : Herbivore {
+  MM_CLASS(Mule, Herbivore);
+  Mule() {
+    MM_INIT();
+  }
+};
+
+BEGIN_SPECIALIZATION(encounter, std::string, const Mule&, const Carnivore&) {
+  return "kick";
+} END_SPECIALIZATION;
+
+extern "C" Animal* make_mule() {
+  return new Mule;
+}
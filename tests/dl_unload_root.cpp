@@ -0,0 +1,66 @@
+// dl_unload_root.cpp
+// Copyright (c) 2013 Jean-Louis Leroy
+// Distributed under the Boost Software License, Version 1.0. (See
+// accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+// Loaded and unloaded by dl_unload: a hierarchy of its own, and a
+// method rooted in it.
+
+#include <yorel/multi_methods.hpp>
+
+#include <string>
+
+using yorel::multi_methods::selector;
+using yorel::multi_methods::virtual_;
+
+namespace plants {
+
+struct Plant : selector {
+  MM_CLASS(Plant);
+  Plant() {
+    MM_INIT();
+  }
+  virtual ~Plant() { }
+};
+
+struct Tree : Plant {
+  MM_CLASS(Tree, Plant);
+  Tree() {
+    MM_INIT();
+  }
+};
+
+struct Oak : Tree {
+  MM_CLASS(Oak, Tree);
+  Oak() {
+    MM_INIT();
+  }
+};
+
+MULTI_METHOD(grow, std::string, const virtual_<Plant>&, const virtual_<Plant>&);
+
+BEGIN_SPECIALIZATION(grow, std::string, const Plant&, const Plant&) {
+  return "plant";
+} END_SPECIALIZATION;
+
+BEGIN_SPECIALIZATION(grow, std::string, const Tree&, const Plant&) {
+  return "tree";
+} END_SPECIALIZATION;
+
+BEGIN_SPECIALIZATION(grow, std::string, const Oak&, const Tree&) {
+  return "oak";
+} END_SPECIALIZATION;
+
+}
+
+using namespace plants;
+
+extern "C" const char* grow_plants() {
+  static std::string result;
+  Oak oak;
+  Tree tree;
+  Plant plant;
+  result = grow(oak, tree) + " " + grow(tree, oak) + " " + grow(plant, oak);
+  return result.c_str();
+}
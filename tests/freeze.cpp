@@ -0,0 +1,178 @@
+// freeze.cpp
+// Copyright (c) 2013 Jean-Louis Leroy
+// Distributed under the Boost Software License, Version 1.0. (See
+// accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+// Freezes the dispatch data, checks that it lives on read-only pages
+// and that changes are refused, then dispatches from forked workers.
+// Separate from tests.cpp because freezing is final.
+
+#include <yorel/multi_methods.hpp>
+#include <yorel/methods/runtime.hpp>
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+#ifdef __linux__
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+using yorel::multi_methods::virtual_;
+using yorel::multi_methods::selector;
+
+namespace {
+
+int failed;
+
+#define check(expr)                                             \
+  if (!(expr)) {                                                \
+    cerr << __FILE__ << ":" << __LINE__ << ": " << #expr << endl; \
+    ++failed;                                                   \
+  }
+
+}
+
+struct role {
+  virtual ~role() { }
+};
+
+MM_FOREIGN_CLASS(role);
+
+struct manager : role {
+};
+
+MM_FOREIGN_CLASS(manager, role);
+
+struct expense : selector {
+  MM_CLASS(expense);
+  expense() {
+    MM_INIT();
+  }
+};
+
+struct plane : expense {
+  MM_CLASS(plane, expense);
+  plane() {
+    MM_INIT();
+  }
+};
+
+MULTI_METHOD(approve, string, const virtual_<expense>&, const virtual_<role>&);
+
+BEGIN_SPECIALIZATION(approve, string, const expense&, const role&) {
+  return "no";
+} END_SPECIALIZATION;
+
+BEGIN_SPECIALIZATION(approve, string, const expense&, const manager&) {
+  return "yes";
+} END_SPECIALIZATION;
+
+BEGIN_SPECIALIZATION(approve, string, const plane&, const manager&) {
+  return "maybe";
+} END_SPECIALIZATION;
+
+int dispatch() {
+  int errors = 0;
+  errors += approve(expense(), role()) != "no";
+  errors += approve(expense(), manager()) != "yes";
+  errors += approve(plane(), role()) != "no";
+  errors += approve(plane(), manager()) != "maybe";
+  return errors;
+}
+
+#ifdef __linux__
+// the permissions of the mapping that contains p, e.g. "r--p"
+string permissions(const void* p) {
+  ifstream maps("/proc/self/maps");
+  string line;
+
+  while (getline(maps, line)) {
+    istringstream is(line);
+    unsigned long from, to;
+    char dash;
+    string perms;
+    is >> hex >> from >> dash >> to >> perms;
+
+    if (reinterpret_cast<unsigned long>(p) >= from && reinterpret_cast<unsigned long>(p) < to) {
+      return perms;
+    }
+  }
+
+  return "";
+}
+#endif
+
+int main() {
+  using namespace yorel::multi_methods;
+  using yorel::methods::detail::arena_builder;
+  using yorel::methods::detail::registration;
+
+  initialize();
+  check(!is_frozen());
+  check(dispatch() == 0);
+
+  freeze();
+  check(is_frozen());
+  check(dispatch() == 0);
+
+  // freezing twice is harmless
+  freeze();
+  check(dispatch() == 0);
+
+#ifdef __linux__
+  check(arena_builder::arena_mapped != 0);
+  check(permissions(arena_builder::arena_base) == "r--p");
+#endif
+
+  // foreign classes are looked up in the arena too
+  check(yorel::methods::detail::get_mm_table<false>::frozen.load() != nullptr);
+
+  // nothing left to do
+  initialize();
+
+  try {
+    using approve_plane_manager = approve_specialization<string(const plane&, const manager&)>;
+    decltype(approve)::replace<approve_plane_manager, approve_plane_manager>();
+    check(!"replace() succeeded");
+  } catch (runtime_error&) {
+  }
+
+  {
+    // what a class in a library loaded after freeze() registers
+    registration late([]() { });
+
+    try {
+      initialize();
+      check(!"initialize() succeeded");
+    } catch (runtime_error&) {
+    }
+  }
+
+  check(dispatch() == 0);
+
+#ifdef __linux__
+  const int workers = 4;
+
+  for (int i = 0; i < workers; i++) {
+    if (fork() == 0) {
+      _exit(dispatch() == 0 && permissions(arena_builder::arena_base) == "r--p" ? 0 : 1);
+    }
+  }
+
+  for (int i = 0; i < workers; i++) {
+    int status;
+    wait(&status);
+    check(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+  }
+#endif
+
+  cout << (failed ? "failed" : "passed") << endl;
+
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,204 @@
+// numa.cpp
+// Copyright (c) 2013 Jean-Louis Leroy
+// Distributed under the Boost Software License, Version 1.0. (See
+// accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+// Measures the latency of dispatching with cold caches, from threads
+// running on each NUMA node, through each copy of the dispatch data.
+// On a multi-node machine the diagonal - local copy - should be the
+// fastest. With a simulated node count, the copies all live on the
+// same node; the run still checks that each one dispatches correctly.
+
+// ./numa [simulated nodes] [rounds]
+
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <string>
+#include <memory>
+#include <functional>
+
+#ifdef __linux__
+#include <pthread.h>
+#endif
+
+#include <yorel/multi_methods.hpp>
+#include <yorel/methods/runtime.hpp>
+
+#include "util/factories.hpp"
+
+using namespace std;
+using namespace std::chrono;
+
+using yorel::multi_methods::selector;
+using yorel::multi_methods::virtual_;
+
+struct shape : selector {
+  MM_CLASS(shape);
+  shape() {
+    MM_INIT();
+  }
+};
+
+MULTI_METHOD(area, int, const virtual_<shape>&);
+
+BEGIN_SPECIALIZATION(area, int, const shape&) {
+  return 0;
+} END_SPECIALIZATION;
+
+// makes one object of a shape; see util/factories.hpp
+using shape_factory = function<shape*()>;
+
+#define SHAPE(N)                                                        \
+  struct shape ## N : shape {                                           \
+    MM_CLASS(shape ## N, shape);                                        \
+    shape ## N() {                                                      \
+      MM_INIT();                                                        \
+    }                                                                   \
+  };                                                                    \
+  BEGIN_SPECIALIZATION(area, int, const shape ## N&) {                  \
+    return 1 ## N;                                                      \
+  } END_SPECIALIZATION;                                                 \
+  ADD_FACTORY(shape_factory, N, []() -> shape* { return new shape ## N; });
+
+#define SHAPES_10(N) \
+  SHAPE(N ## 0) SHAPE(N ## 1) SHAPE(N ## 2) SHAPE(N ## 3) SHAPE(N ## 4) \
+  SHAPE(N ## 5) SHAPE(N ## 6) SHAPE(N ## 7) SHAPE(N ## 8) SHAPE(N ## 9)
+
+#define SHAPES_100(N) \
+  SHAPES_10(N ## 0) SHAPES_10(N ## 1) SHAPES_10(N ## 2) SHAPES_10(N ## 3) SHAPES_10(N ## 4) \
+  SHAPES_10(N ## 5) SHAPES_10(N ## 6) SHAPES_10(N ## 7) SHAPES_10(N ## 8) SHAPES_10(N ## 9)
+
+SHAPES_100(0)
+SHAPES_100(1)
+SHAPES_100(2)
+
+namespace {
+
+// the cpus of a node, empty if the node does not exist
+vector<int> node_cpus(int node) {
+  vector<int> cpus;
+  ifstream list("/sys/devices/system/node/node" + to_string(node) + "/cpulist");
+  string range;
+
+  while (getline(list, range, ',')) {
+    auto dash = range.find('-');
+    int first = stoi(range);
+    int last = dash == string::npos ? first : stoi(range.substr(dash + 1));
+
+    for (int cpu = first; cpu <= last; cpu++) {
+      cpus.push_back(cpu);
+    }
+  }
+
+  return cpus;
+}
+
+void pin(thread& t, const vector<int>& cpus) {
+#ifdef __linux__
+  if (cpus.empty()) {
+    return;
+  }
+
+  cpu_set_t set;
+  CPU_ZERO(&set);
+
+  for (int cpu : cpus) {
+    CPU_SET(cpu, &set);
+  }
+
+  pthread_setaffinity_np(t.native_handle(), sizeof(set), &set);
+#endif
+}
+
+// larger than the last level cache
+vector<char> cache_buster(64 * 1024 * 1024);
+
+void evict() {
+  for (size_t i = 0; i < cache_buster.size(); i += 64) {
+    cache_buster[i]++;
+  }
+}
+
+}
+
+int main(int argc, char** argv) {
+  using namespace yorel::multi_methods;
+
+  if (argc > 1) {
+    detail::arena_builder::numa_nodes = stoi(argv[1]);
+  }
+
+  const int rounds = argc > 2 ? stoi(argv[2]) : 100;
+
+  enable_numa_replicas();
+  initialize();
+
+  const int nodes = detail::arena_builder::replicas();
+
+  if (nodes > 1 && !detail::arena_builder::replica_memory[nodes - 1]) {
+    cerr << "no copy of the dispatch data for node " << nodes - 1 << endl;
+    return 1;
+  }
+
+  vector<unique_ptr<shape>> objects;
+
+  for (auto& make : factories<shape_factory>()) {
+    objects.emplace_back(make());
+  }
+
+  cout << nodes << " copies of the dispatch data, " << objects.size() << " classes, "
+       << rounds << " rounds\n"
+       << "ns per dispatch with cold caches, thread node (rows) x copy (columns)\n";
+
+  cout << setw(6) << " ";
+  for (int copy = 0; copy < nodes; copy++) {
+    cout << setw(10) << copy;
+  }
+  cout << endl;
+
+  int errors = 0;
+
+  for (int node = 0; node < nodes; node++) {
+    cout << setw(6) << node;
+
+    for (int copy = 0; copy < nodes; copy++) {
+      double nanosecs = 0;
+
+      thread worker([&]() {
+          select_replica(copy);
+
+          for (int round = 0; round < rounds; round++) {
+            evict();
+            auto start = steady_clock::now();
+
+            for (size_t i = 0; i < objects.size(); i++) {
+              if (area(*objects[i]) != 1000 + int(i)) {
+                ++errors;
+              }
+            }
+
+            nanosecs += duration<double, nano>(steady_clock::now() - start).count();
+          }
+        });
+
+      pin(worker, node_cpus(node));
+      worker.join();
+
+      cout << setw(10) << fixed << setprecision(1) << nanosecs / rounds / objects.size() << flush;
+    }
+
+    cout << endl;
+  }
+
+  if (errors) {
+    cerr << errors << " wrong dispatches" << endl;
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,166 @@
+// parallel.cpp
+// Copyright (c) 2013 Jean-Louis Leroy
+// Distributed under the Boost Software License, Version 1.0. (See
+// accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+// Calls a method on each of a shuffled array of objects of 300
+// classes, from 1 to N threads, with parallel_for_each() and with a
+// naive split of the array into one slice per thread.
+
+// ./parallel [max threads] [objects]
+
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <random>
+#include <algorithm>
+
+#include <yorel/multi_methods.hpp>
+
+#include "util/factories.hpp"
+
+using namespace std;
+using namespace std::chrono;
+
+using yorel::multi_methods::selector;
+using yorel::multi_methods::virtual_;
+
+struct shape : selector {
+  MM_CLASS(shape);
+  shape() : size(1) {
+    MM_INIT();
+  }
+  double size;
+};
+
+MULTI_METHOD(grow, void, virtual_<shape>&, double);
+
+BEGIN_SPECIALIZATION(grow, void, shape& s, double factor) {
+  s.size *= factor;
+} END_SPECIALIZATION;
+
+// makes one object of a shape; see util/factories.hpp
+using shape_factory = function<shape*()>;
+
+#define SHAPE(N)                                                        \
+  struct shape ## N : shape {                                           \
+    MM_CLASS(shape ## N, shape);                                        \
+    shape ## N() {                                                      \
+      MM_INIT();                                                        \
+    }                                                                   \
+  };                                                                    \
+  BEGIN_SPECIALIZATION(grow, void, shape ## N& s, double factor) {      \
+    s.size = s.size * factor + 1 ## N % 7;                              \
+  } END_SPECIALIZATION;                                                 \
+  ADD_FACTORY(shape_factory, N, []() -> shape* { return new shape ## N; });
+
+#define SHAPES_10(N) \
+  SHAPE(N ## 0) SHAPE(N ## 1) SHAPE(N ## 2) SHAPE(N ## 3) SHAPE(N ## 4) \
+  SHAPE(N ## 5) SHAPE(N ## 6) SHAPE(N ## 7) SHAPE(N ## 8) SHAPE(N ## 9)
+
+#define SHAPES_100(N) \
+  SHAPES_10(N ## 0) SHAPES_10(N ## 1) SHAPES_10(N ## 2) SHAPES_10(N ## 3) SHAPES_10(N ## 4) \
+  SHAPES_10(N ## 5) SHAPES_10(N ## 6) SHAPES_10(N ## 7) SHAPES_10(N ## 8) SHAPES_10(N ## 9)
+
+SHAPES_100(0)
+SHAPES_100(1)
+SHAPES_100(2)
+
+namespace {
+
+using shapes = vector<unique_ptr<shape>>;
+
+void naive(const shapes& objects, int threads) {
+  vector<thread> workers;
+  const size_t slice = (objects.size() + threads - 1) / threads;
+
+  for (int i = 0; i < threads; i++) {
+    workers.push_back(thread([&, i]() {
+          const size_t last = min(objects.size(), (i + 1) * slice);
+          for (size_t j = i * slice; j < last; j++) {
+            grow(*objects[j], 1.5);
+          }
+        }));
+  }
+
+  for (auto& worker : workers) {
+    worker.join();
+  }
+}
+
+void stealing(const shapes& objects, int threads) {
+  yorel::multi_methods::set_parallel_threads(threads);
+  yorel::multi_methods::parallel_for_each(grow, objects, 1.5);
+}
+
+// Returns millions of objects per second.
+double time(const shapes& objects, int threads, void (*run)(const shapes&, int)) {
+  for (auto& object : objects) {
+    object->size = 1;
+  }
+
+  auto start = steady_clock::now();
+  run(objects, threads);
+  double seconds = duration<double>(steady_clock::now() - start).count();
+
+  for (auto& object : objects) {
+    if (object->size == 1) {
+      cerr << "object not visited" << endl;
+      exit(1);
+    }
+  }
+
+  return objects.size() / seconds / 1e6;
+}
+
+}
+
+int main(int argc, char** argv) {
+  yorel::multi_methods::initialize();
+
+  const int max_threads = argc > 1 ? stoi(argv[1]) : max(1u, thread::hardware_concurrency());
+  const size_t count = argc > 2 ? stoul(argv[2]) : 4 * 1000 * 1000;
+
+  shapes objects;
+  mt19937 random;
+
+  for (size_t i = 0; i < count; i++) {
+    objects.emplace_back(factories<shape_factory>()[random() % factories<shape_factory>().size()]());
+  }
+
+  vector<int> thread_counts;
+
+  for (int threads = 1; threads < max_threads; threads *= 2) {
+    thread_counts.push_back(threads);
+  }
+
+  thread_counts.push_back(max_threads);
+
+  cout << count << " objects of " << factories<shape_factory>().size() << " classes, "
+       << "millions of objects per second (speedup)\n"
+       << setw(8) << "threads" << setw(20) << "naive split" << setw(20) << "parallel_for_each" << endl;
+
+  double naive_single = 0, stealing_single = 0;
+
+  for (int threads : thread_counts) {
+    double naive_rate = time(objects, threads, naive);
+    double stealing_rate = time(objects, threads, stealing);
+
+    if (threads == 1) {
+      naive_single = naive_rate;
+      stealing_single = stealing_rate;
+    }
+
+    cout << setw(8) << threads << fixed << setprecision(1)
+         << setw(12) << naive_rate << " (" << setw(4) << naive_rate / naive_single << "x)"
+         << setw(12) << stealing_rate << " (" << setw(4) << stealing_rate / stealing_single << "x)"
+         << endl;
+  }
+
+  return 0;
+}
@@ -0,0 +1,169 @@
+// probes.cpp
+// Copyright (c) 2013 Jean-Louis Leroy
+// Distributed under the Boost Software License, Version 1.0. (See
+// accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+// Checks that the static probes are described in the .note.stapsdt
+// section of the executable, and that the code around them still
+// works. Built with YOMM11_ENABLE_PROBES.
+
+#include <yorel/multi_methods.hpp>
+
+#include <iostream>
+#include <fstream>
+#include <iterator>
+#include <set>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#ifdef __linux__
+#include <elf.h>
+#endif
+
+using namespace std;
+
+using yorel::multi_methods::virtual_;
+using yorel::multi_methods::selector;
+
+namespace {
+
+int failed;
+
+#define check(expr)                                             \
+  if (!(expr)) {                                                \
+    cerr << __FILE__ << ":" << __LINE__ << ": " << #expr << endl; \
+    ++failed;                                                   \
+  }
+
+}
+
+struct Animal : selector {
+  MM_CLASS(Animal);
+  Animal() {
+    MM_INIT();
+  }
+};
+
+struct Cow : Animal {
+  MM_CLASS(Cow, Animal);
+  Cow() {
+    MM_INIT();
+  }
+};
+
+struct Wolf : Animal {
+  MM_CLASS(Wolf, Animal);
+  Wolf() {
+    MM_INIT();
+  }
+};
+
+MULTI_METHOD(milk, int, virtual_<Animal>&);
+
+BEGIN_SPECIALIZATION(milk, int, Cow&) {
+  return 1;
+} END_SPECIALIZATION;
+
+MULTI_METHOD(encounter, int, virtual_<Animal>&, virtual_<Animal>&);
+
+BEGIN_SPECIALIZATION(encounter, int, Wolf&, Animal&) {
+  return 1;
+} END_SPECIALIZATION;
+
+BEGIN_SPECIALIZATION(encounter, int, Animal&, Wolf&) {
+  return 2;
+} END_SPECIALIZATION;
+
+#if defined(__linux__) && (defined(__x86_64__) || defined(__aarch64__))
+
+// "provider:name args" for each note in .note.stapsdt
+set<string> probes() {
+  set<string> result;
+  ifstream file("/proc/self/exe", ios::binary);
+  vector<char> image((istreambuf_iterator<char>(file)), istreambuf_iterator<char>());
+  auto header = reinterpret_cast<const Elf64_Ehdr*>(image.data());
+  auto sections = reinterpret_cast<const Elf64_Shdr*>(image.data() + header->e_shoff);
+  const char* names = image.data() + sections[header->e_shstrndx].sh_offset;
+
+  for (int i = 0; i < header->e_shnum; i++) {
+    if (string(names + sections[i].sh_name) != ".note.stapsdt") {
+      continue;
+    }
+
+    const char* note = image.data() + sections[i].sh_offset;
+    const char* end = note + sections[i].sh_size;
+
+    while (note < end) {
+      auto nhdr = reinterpret_cast<const Elf64_Nhdr*>(note);
+      const char* desc = note + sizeof(*nhdr) + ((nhdr->n_namesz + 3) & ~3);
+      // pc, base, semaphore, then three strings
+      const char* provider = desc + 3 * 8;
+      const char* name = provider + strlen(provider) + 1;
+      const char* args = name + strlen(name) + 1;
+      result.insert(string(provider) + ":" + name + (*args ? " " : "") + args);
+      note = desc + ((nhdr->n_descsz + 3) & ~3);
+    }
+  }
+
+  return result;
+}
+
+bool has_probe(const set<string>& all, const string& probe) {
+  for (auto& p : all) {
+    if (p.compare(0, probe.size(), probe) == 0) {
+      return true;
+    }
+  }
+
+  cerr << "no probe " << probe << endl;
+  return false;
+}
+
+#endif
+
+int main() {
+  using namespace yorel::multi_methods;
+
+  initialize();
+
+  Cow cow;
+  Wolf wolf;
+
+  check(milk(cow) == 1);
+  check(encounter(wolf, cow) == 1);
+
+  try {
+    milk(wolf);
+    check(!"undefined not thrown");
+  } catch (undefined&) {
+  }
+
+  try {
+    encounter(wolf, wolf);
+    check(!"ambiguous not thrown");
+  } catch (ambiguous&) {
+  }
+
+#if defined(__linux__) && (defined(__x86_64__) || defined(__aarch64__))
+  auto all = probes();
+
+  for (auto& probe : all) {
+    cout << probe << endl;
+  }
+
+  check(has_probe(all, "yomm11:initialize__begin"));
+  check(has_probe(all, "yomm11:initialize__end -4@"));
+  check(has_probe(all, "yomm11:hierarchy__begin 8@"));
+  check(has_probe(all, "yomm11:hierarchy__end 8@"));
+  check(has_probe(all, "yomm11:resolve__begin 8@"));
+  check(has_probe(all, "yomm11:resolve__end 8@"));
+  check(has_probe(all, "yomm11:undefined 8@"));
+  check(has_probe(all, "yomm11:ambiguous 8@"));
+#endif
+
+  cout << (failed ? "failed" : "passed") << endl;
+
+  return failed ? 1 : 0;
+}
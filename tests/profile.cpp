@@ -0,0 +1,151 @@
+// profile.cpp
+// Copyright (c) 2013 Jean-Louis Leroy
+// Distributed under the Boost Software License, Version 1.0. (See
+// accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+// Counts calls from several threads, across a re-computation of the
+// dispatch tables, and checks the JSON profile. Built with
+// YOMM11_ENABLE_PROFILE.
+
+#include <yorel/multi_methods.hpp>
+
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+using yorel::multi_methods::virtual_;
+using yorel::multi_methods::selector;
+
+namespace {
+
+int failed;
+
+#define check(expr)                                             \
+  if (!(expr)) {                                                \
+    cerr << __FILE__ << ":" << __LINE__ << ": " << #expr << endl; \
+    ++failed;                                                   \
+  }
+
+}
+
+struct Animal : selector {
+  MM_CLASS(Animal);
+  Animal() {
+    MM_INIT();
+  }
+};
+
+struct Cow : Animal {
+  MM_CLASS(Cow, Animal);
+  Cow() {
+    MM_INIT();
+  }
+};
+
+struct Wolf : Animal {
+  MM_CLASS(Wolf, Animal);
+  Wolf() {
+    MM_INIT();
+  }
+};
+
+MULTI_METHOD(encounter, string, virtual_<Animal>&, virtual_<Animal>&);
+
+BEGIN_SPECIALIZATION(encounter, string, Animal&, Animal&) {
+  return "ignore";
+} END_SPECIALIZATION;
+
+BEGIN_SPECIALIZATION(encounter, string, Wolf&, Animal&) {
+  return "hunt";
+} END_SPECIALIZATION;
+
+BEGIN_SPECIALIZATION(encounter, string, Cow&, Wolf&) {
+  return "run";
+} END_SPECIALIZATION;
+
+MULTI_METHOD(milk, int, virtual_<Animal>&);
+
+BEGIN_SPECIALIZATION(milk, int, Cow&) {
+  return 1;
+} END_SPECIALIZATION;
+
+string profile() {
+  ostringstream os;
+  yorel::multi_methods::dump_profile(os);
+  return os.str();
+}
+
+bool contains(const string& s, const string& part) {
+  if (s.find(part) == string::npos) {
+    cerr << "not found: " << part << endl;
+    return false;
+  }
+  return true;
+}
+
+int main() {
+  using namespace yorel::multi_methods;
+
+  initialize();
+
+  const int threads = 4, calls = 1000;
+  vector<thread> callers;
+
+  for (int i = 0; i < threads; i++) {
+    callers.push_back(thread([]() {
+          Cow cow;
+          Wolf wolf;
+          for (int n = 0; n < calls; n++) {
+            encounter(wolf, cow);
+            encounter(cow, wolf);
+            encounter(cow, wolf);
+            milk(cow);
+          }
+        }));
+  }
+
+  for (auto& caller : callers) {
+    caller.join();
+  }
+
+  Cow cow;
+  Wolf wolf;
+
+  try {
+    milk(wolf);
+  } catch (undefined&) {
+  }
+
+  string dump = profile();
+  cout << dump;
+
+  check(contains(dump, "\"name\": \"encounter\",\n      \"calls\": 12000,"));
+  check(contains(dump, "{ \"classes\": [\"Animal\", \"Animal\"], \"calls\": 0 }"));
+  check(contains(dump, "{ \"classes\": [\"Wolf\", \"Animal\"], \"calls\": 4000 }"));
+  check(contains(dump, "{ \"classes\": [\"Cow\", \"Wolf\"], \"calls\": 8000 }"));
+  check(contains(dump, "\"name\": \"milk\",\n      \"calls\": 4001,\n      \"undefined\": 1,"));
+
+  // the counts survive the re-computation of the tables
+  encounter.the().invalidate();
+  initialize();
+  encounter(cow, cow);
+  dump = profile();
+  check(contains(dump, "{ \"classes\": [\"Animal\", \"Animal\"], \"calls\": 1 }"));
+  check(contains(dump, "{ \"classes\": [\"Cow\", \"Wolf\"], \"calls\": 8000 }"));
+
+  reset_profile();
+  encounter(wolf, wolf);
+  dump = profile();
+  check(contains(dump, "{ \"classes\": [\"Cow\", \"Wolf\"], \"calls\": 0 }"));
+  check(contains(dump, "{ \"classes\": [\"Wolf\", \"Animal\"], \"calls\": 1 }"));
+  check(contains(dump, "\"name\": \"milk\",\n      \"calls\": 0,"));
+
+  cout << (failed ? "failed" : "passed") << endl;
+
+  return failed ? 1 : 0;
+}
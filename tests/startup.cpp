@@ -0,0 +1,138 @@
+// startup.cpp
+// Copyright (c) 2013 Jean-Louis Leroy
+// Distributed under the Boost Software License, Version 1.0. (See
+// accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+// Measures the cost of registering many classes and specializations
+// during static initialization, of the first call to initialize(), and
+// of re-computing all the dispatch data. See util/bench.hpp for the
+// options.
+
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <map>
+
+using namespace std;
+using namespace std::chrono;
+
+namespace {
+// initialized before the registrations below
+const auto registration_start = steady_clock::now();
+}
+
+#include <yorel/multi_methods.hpp>
+#include <yorel/methods/runtime.hpp>
+
+#include "util/bench.hpp"
+
+using yorel::multi_methods::selector;
+using yorel::multi_methods::virtual_;
+
+struct shape : selector {
+  MM_CLASS(shape);
+  shape() {
+    MM_INIT();
+  }
+};
+
+MULTI_METHOD(area, int, const virtual_<shape>&);
+
+BEGIN_SPECIALIZATION(area, int, const shape&) {
+  return 0;
+} END_SPECIALIZATION;
+
+MULTI_METHOD(intersect, int, const virtual_<shape>&, const virtual_<shape>&);
+
+BEGIN_SPECIALIZATION(intersect, int, const shape&, const shape&) {
+  return 0;
+} END_SPECIALIZATION;
+
+#define SHAPE(N)                                                        \
+  struct shape ## N : shape {                                           \
+    MM_CLASS(shape ## N, shape);                                        \
+    shape ## N() {                                                      \
+      MM_INIT();                                                        \
+    }                                                                   \
+  };                                                                    \
+  BEGIN_SPECIALIZATION(area, int, const shape ## N&) {                  \
+    return 1 ## N;                                                      \
+  } END_SPECIALIZATION;                                                 \
+  BEGIN_SPECIALIZATION(intersect, int, const shape ## N&, const shape&) { \
+    return 1 ## N;                                                      \
+  } END_SPECIALIZATION;
+
+#define SHAPES_10(N) \
+  SHAPE(N ## 0) SHAPE(N ## 1) SHAPE(N ## 2) SHAPE(N ## 3) SHAPE(N ## 4) \
+  SHAPE(N ## 5) SHAPE(N ## 6) SHAPE(N ## 7) SHAPE(N ## 8) SHAPE(N ## 9)
+
+#define SHAPES_100(N) \
+  SHAPES_10(N ## 0) SHAPES_10(N ## 1) SHAPES_10(N ## 2) SHAPES_10(N ## 3) SHAPES_10(N ## 4) \
+  SHAPES_10(N ## 5) SHAPES_10(N ## 6) SHAPES_10(N ## 7) SHAPES_10(N ## 8) SHAPES_10(N ## 9)
+
+SHAPES_100(0)
+SHAPES_100(1)
+SHAPES_100(2)
+
+namespace {
+const auto registration_end = steady_clock::now();
+}
+
+void post(const string& description, double millisecs) {
+  cout << setw(50) << left << description << ": "
+       << setw(8) << fixed << right << setprecision(3) << millisecs << endl;
+}
+
+int main(int argc, char** argv) {
+  auto start = steady_clock::now();
+  yorel::multi_methods::initialize();
+  auto end = steady_clock::now();
+
+  const double registration = duration<double, milli>(registration_end - registration_start).count();
+  const double first = duration<double, milli>(end - start).count();
+
+  cout << "300 classes, 601 specializations, time in millisecs\n";
+  post("static registration", registration);
+  post("first initialize()", first);
+  cout << endl;
+
+  // make sure the tables are right
+  if (area(shape123()) != 1123 || intersect(shape256(), shape()) != 1256) {
+    cout << "wrong dispatch\n";
+    return 1;
+  }
+
+  bench::runner runner(argc, argv);
+
+  runner.header("re-computing all the dispatch data");
+
+  // ns per initialize()
+  if (runner.run("initialize, 300 classes, 601 specializations", [](size_t n) {
+        using namespace yorel::methods::detail;
+
+        for (size_t i = 0; i < n; i++) {
+          yomm11_class::add_to_initialize(&yomm11_class::of<shape>::the());
+          area.the().invalidate();
+          intersect.the().invalidate();
+          yorel::multi_methods::initialize();
+        }
+      })) {
+    runner.counter("static registration ms", registration);
+    runner.counter("first initialize ms", first);
+  }
+
+  // allocates and chases pointers like initialize(), without it - to
+  // compare runs on different machines, see --normalize
+  runner.run("reference, std::map of 10000 ints", [](size_t n) {
+      for (size_t i = 0; i < n; i++) {
+        map<int, int> m;
+        for (int j = 0; j < 10000; j++) {
+          m[j * 7919 % 10007] = j;
+        }
+        bench::do_not_optimize(m);
+      }
+    });
+
+  return runner.finish();
+}
@@ -4,18 +4,16 @@
 // accompanying file LICENSE_1_0.txt or copy at
 // http://www.boost.org/LICENSE_1_0.txt)
 
-//#define YOREL_MM_ENABLE_TRACE
-
-#ifdef YOREL_MM_ENABLE_TRACE
-#include "../src/yomm11.cpp"
-#endif
-
 #include <yorel/methods.hpp>
 #include <yorel/methods/runtime.hpp>
 
 #include <iostream>
 #include <iomanip>
 #include <sstream>
+#include <thread>
+#include <atomic>
+#include <future>
+#include <chrono>
 
 #include "util/join.hpp"
 
@@ -32,8 +30,6 @@ int success, failure;
 
 using methods = vector<specialization_base*>;
 
-#ifndef YOMM11_ENABLE_TRACE
-
 ostream& operator <<(ostream& os, const vector<specialization_base*>& methods) {
   using namespace std;
   const char* sep = "";
@@ -47,8 +43,6 @@ ostream& operator <<(ostream& os, const vector<specialization_base*>& methods) {
   return os;
 }
 
-#endif
-
 template<class T1, class T2>
 bool _test(const char* file, int line, const char* test, const T1& got, const char* expected_expr, const T2& expected) {
   string ee;
@@ -89,6 +83,27 @@ bool throws(function<void()> fun) {
   return false;
 }
 
+// The function that cell i of a method's dispatch table leads to, and
+// the cell of the first dimension that an entry in an mm table selects,
+// whatever the encoding of the dispatch data.
+template<class Implementation>
+typename Implementation::method_pointer_type cell_target(const Implementation& impl, int i) {
+#ifdef YOMM11_COMPACT_DISPATCH
+  return impl.targets[impl.dispatch_table[i]];
+#else
+  return impl.dispatch_table[i];
+#endif
+}
+
+template<class Implementation>
+long first_cell(const Implementation& impl, const yomm11_class::offset& entry) {
+#ifdef YOMM11_COMPACT_DISPATCH
+  return entry.index;
+#else
+  return entry.ptr - reinterpret_cast<method_base::void_function_pointer*>(impl.dispatch_table);
+#endif
+}
+
 unsigned long binary(const char* digits) {
   unsigned long bits = 0;
 
@@ -333,6 +348,29 @@ BEGIN_SPECIALIZATION(display, action, Animal& a, Terminal& b) {
   return display_error;
 } END_SPECIALIZATION;
 
+// for hot swap tests
+
+struct stalk {
+  static string body(Carnivore&, Animal&) {
+    return "stalk";
+  }
+};
+
+// not registered: inserted in place
+struct track : std::remove_const<decltype(encounter)>::type::specialization<track> {
+  using body_signature = yorel::methods::detail::signature<string(Carnivore&, Wolf&)>;
+  static string body(Carnivore&, Wolf&) {
+    return "track";
+  }
+};
+
+struct graze : std::remove_const<decltype(encounter)>::type::specialization<graze> {
+  using body_signature = yorel::methods::detail::signature<string(Herbivore&, Herbivore&)>;
+  static string body(Herbivore&, Herbivore&) {
+    return "graze";
+  }
+};
+
 // following un-registered stuff is for unloading tests
 
 struct Donkey : Herbivore { };
@@ -362,6 +400,26 @@ BEGIN_SPECIALIZATION(encounter, string, Stallion&, Mare&) {
 BEGIN_SPECIALIZATION(encounter, string, Predator&, Herbivore&) {
   return "hunt";
 } END_SPECIALIZATION;
+
+// Stallion and Mare select different specializations, but all the
+// cells in their rows are ambiguous
+MULTI_METHOD(mate, string, virtual_<Animal>&, virtual_<Animal>&);
+
+BEGIN_SPECIALIZATION(mate, string, Male&, Animal&) {
+  return "male";
+} END_SPECIALIZATION;
+
+BEGIN_SPECIALIZATION(mate, string, Female&, Animal&) {
+  return "female";
+} END_SPECIALIZATION;
+
+BEGIN_SPECIALIZATION(mate, string, Herbivore&, Animal&) {
+  return "herbivore";
+} END_SPECIALIZATION;
+
+BEGIN_SPECIALIZATION(mate, string, Animal&, Wolf&) {
+  return "wolf";
+} END_SPECIALIZATION;
 }
 
 namespace adjust {
@@ -426,6 +484,53 @@ BEGIN_SPECIALIZATION(mxy, int, const XY& xy) {
 
 }
 
+namespace geo {
+
+struct shape {
+  virtual ~shape() { }
+};
+
+struct circle : shape {
+};
+
+}
+
+namespace foreign_other_namespace {
+
+using geo::shape;
+using geo::circle;
+
+MM_FOREIGN_CLASS(shape);
+MM_FOREIGN_CLASS(circle, shape);
+
+MULTI_METHOD(sides, int, const virtual_<shape>&);
+
+BEGIN_SPECIALIZATION(sides, int, const shape&) {
+  return -1;
+} END_SPECIALIZATION;
+
+BEGIN_SPECIALIZATION(sides, int, const circle&) {
+  return 0;
+} END_SPECIALIZATION;
+
+}
+
+namespace unloaded {
+
+struct Spore {
+  virtual ~Spore() { }
+};
+
+MM_FOREIGN_CLASS(Spore);
+
+MULTI_METHOD(germinate, int, const virtual_<Spore>&);
+
+BEGIN_SPECIALIZATION(germinate, int, const Spore&) {
+  return 1;
+} END_SPECIALIZATION;
+
+}
+
 namespace multi_roots_foreign {
 
 struct X {
@@ -447,6 +552,10 @@ struct XY : X, Y {
 
 MM_FOREIGN_CLASS(XY, X, Y);
 
+// not registered
+struct XYZ : XY {
+};
+
 MULTI_METHOD(mx, int, const virtual_<X>&);
 
 BEGIN_SPECIALIZATION(mx, int, const X& x) {
@@ -552,7 +661,200 @@ BEGIN_SPECIALIZATION(mab, int, const AB& ab) {
 
 }
 
+namespace slot_sharing {
+
+struct Shape : selector {
+  MM_CLASS(Shape);
+  Shape() {
+    MM_INIT();
+  }
+};
+
+struct Circle : Shape {
+  MM_CLASS(Circle, Shape);
+  Circle() {
+    MM_INIT();
+  }
+};
+
+struct Square : Shape {
+  MM_CLASS(Square, Shape);
+  Square() {
+    MM_INIT();
+  }
+};
+
+// no specializations of its own
+struct Disk : Circle {
+  MM_CLASS(Disk, Circle);
+  Disk() {
+    MM_INIT();
+  }
+};
+
+MULTI_METHOD(intersect, string, virtual_<Shape>&, virtual_<Shape>&);
+
+BEGIN_SPECIALIZATION(intersect, string, Shape&, Shape&) {
+  return "shapes";
+} END_SPECIALIZATION;
+
+BEGIN_SPECIALIZATION(intersect, string, Circle&, Circle&) {
+  return "circles";
+} END_SPECIALIZATION;
+
+MULTI_METHOD(overlap, string, virtual_<Shape>&, virtual_<Shape>&);
+
+BEGIN_SPECIALIZATION(overlap, string, Shape&, Shape&) {
+  return "shapes";
+} END_SPECIALIZATION;
+
+BEGIN_SPECIALIZATION(overlap, string, Square&, Circle&) {
+  return "square, circle";
+} END_SPECIALIZATION;
+
+// added at run time
+struct overlap_shape_square : std::remove_const<decltype(overlap)>::type::specialization<overlap_shape_square> {
+  using body_signature = signature<string(Shape&, Square&)>;
+  static string body(Shape&, Square&) {
+    return "shape, square";
+  }
+};
+
+}
+
+namespace parallel_dispatch {
+
+struct Shape : selector {
+  MM_CLASS(Shape);
+  Shape() {
+    MM_INIT();
+  }
+};
+
+struct Circle : Shape {
+  MM_CLASS(Circle, Shape);
+  Circle() {
+    MM_INIT();
+  }
+};
+
+struct Square : Shape {
+  MM_CLASS(Square, Shape);
+  Square() {
+    MM_INIT();
+  }
+};
+
+MULTI_METHOD(tally, void, virtual_<Shape>&, vector<atomic<int>>&);
+
+BEGIN_SPECIALIZATION(tally, void, Shape&, vector<atomic<int>>& counts) {
+  ++counts[0];
+} END_SPECIALIZATION;
+
+BEGIN_SPECIALIZATION(tally, void, Circle&, vector<atomic<int>>& counts) {
+  ++counts[1];
+} END_SPECIALIZATION;
+
+BEGIN_SPECIALIZATION(tally, void, Square&, vector<atomic<int>>& counts) {
+  ++counts[2];
+} END_SPECIALIZATION;
+
+// runs a parallel_for_each from a task
+MULTI_METHOD(nest, void, virtual_<Shape>&, vector<Shape*>&, vector<atomic<int>>&);
+
+BEGIN_SPECIALIZATION(nest, void, Shape&, vector<Shape*>& inner, vector<atomic<int>>& counts) {
+  parallel_for_each(tally, inner, counts);
+} END_SPECIALIZATION;
+
+MULTI_METHOD(check, void, virtual_<Shape>&);
+
+BEGIN_SPECIALIZATION(check, void, Shape&) {
+} END_SPECIALIZATION;
+
+BEGIN_SPECIALIZATION(check, void, Square&) {
+  throw runtime_error("square");
+} END_SPECIALIZATION;
+
+}
+
+namespace static_registration {
+
+int processed;
+
+void process() {
+  ++processed;
+}
+
+}
+
 int main() {
+  // process the classes and specializations registered during static
+  // initialization, so the tests below can inspect them
+  registration::run_pending();
+
+  {
+    cout << "\n--- Static registration." << endl;
+    using namespace static_registration;
+
+    test(registration::first == nullptr, true);
+
+    {
+      registration node(process);
+      test(registration::first, &node);
+      test(registration::last, &node);
+      registration::run_pending();
+      test(processed, 1);
+      test(node.linked, false);
+      test(registration::first == nullptr, true);
+    }
+
+    {
+      registration node(process);
+    }
+
+    // a node destroyed before initialize() unlinks itself
+    test(registration::first == nullptr, true);
+    registration::run_pending();
+    test(processed, 1);
+
+    // nodes linked by other threads while initialize() runs
+    {
+      const int threads = 4, nodes = 1000;
+      atomic<int> done(0);
+      vector<vector<unique_ptr<registration>>> linked(threads);
+      vector<thread> registrars;
+
+      for (int i = 0; i < threads; i++) {
+        registrars.push_back(thread([&, i]() {
+              for (int n = 0; n < nodes; n++) {
+                linked[i].emplace_back(new registration(process));
+              }
+              ++done;
+            }));
+      }
+
+      while (done < threads) {
+        registration::run_pending();
+      }
+
+      for (auto& registrar : registrars) {
+        registrar.join();
+      }
+
+      registration::run_pending();
+      test(processed, 1 + threads * nodes);
+      test(registration::first == nullptr, true);
+    }
+
+    // a class whose base is still being registered - by a thread that
+    // is loading a shared object - waits for the next initialize()
+    {
+      yomm11_class base, derived;
+      test(derived.initialize({ &base }), false);
+      test(derived.root == nullptr, true);
+    }
+  }
+
   {
     using namespace single_inheritance;
     static_assert(
@@ -617,6 +919,14 @@ int main() {
         test(v[n - 1], false);
       }
 
+      {
+        // bits in the upper half of a word are distinct
+        bitvec v(n);
+        v[n - 1] = 1;
+        test(v[(n - 1) % 32], false);
+        test((~v)[(n - 1) % 32], true);
+      }
+
       {
         bitvec v(n, binary("101"));
         test(v[0], true);
@@ -993,33 +1303,30 @@ int main() {
 
     test( table != 0, true);
     // Interface
-    test( table[0], throw_undefined<decltype(display)::signature>::body );
-    test( table[1], throw_undefined<decltype(display)::signature>::body );
-    test( table[2], throw_undefined<decltype(display)::signature>::body );
+    test( cell_target(display.the(), 0), throw_undefined<decltype(display)::signature>::body );
+    test( cell_target(display.the(), 1), throw_undefined<decltype(display)::signature>::body );
+    test( cell_target(display.the(), 2), throw_undefined<decltype(display)::signature>::body );
 
     // Terminal
-    test( table[3], throw_undefined<decltype(display)::signature>::body );
-    test( table[4], static_cast<method*>(methods[0])->pm );
-    test( table[5], static_cast<method*>(methods[2])->pm );
+    test( cell_target(display.the(), 3), throw_undefined<decltype(display)::signature>::body );
+    test( cell_target(display.the(), 4), static_cast<method*>(methods[0])->pm );
+    test( cell_target(display.the(), 5), static_cast<method*>(methods[2])->pm );
 
     // Window
-    test( table[6], throw_undefined<decltype(display)::signature>::body );
-    test( table[7], static_cast<method*>(methods[1])->pm );
-    test( table[8], static_cast<method*>(methods[3])->pm );
+    test( cell_target(display.the(), 6), throw_undefined<decltype(display)::signature>::body );
+    test( cell_target(display.the(), 7), static_cast<method*>(methods[1])->pm );
+    test( cell_target(display.the(), 8), static_cast<method*>(methods[3])->pm );
 
     // Mobile
-    test( table[9], static_cast<method*>(methods[4])->pm );
-    test( table[10], static_cast<method*>(methods[4])->pm );
-    test( table[11], static_cast<method*>(methods[4])->pm );
+    test( cell_target(display.the(), 9), static_cast<method*>(methods[4])->pm );
+    test( cell_target(display.the(), 10), static_cast<method*>(methods[4])->pm );
+    test( cell_target(display.the(), 11), static_cast<method*>(methods[4])->pm );
 
     rdisp.assign_next();
     test( (display_specialization<action(const Carnivore&, const Window&)>::next) == nullptr, true );
 
-    testx( (void*) yomm11_class::of<Animal>::the().mmt[0].ptr,
-           (void*) display.impl->dispatch_table );
-
-    testx( (void*) yomm11_class::of<Herbivore>::the().mmt[0].ptr,
-           (void*) (display.impl->dispatch_table + 1) );
+    test( first_cell(*display.impl, yomm11_class::of<Animal>::the().mmt[0]), 0 );
+    test( first_cell(*display.impl, yomm11_class::of<Herbivore>::the().mmt[0]), 1 );
 
     test( display(Herbivore(), Terminal()), print_herbivore );
     test( display(Cow(), Terminal()), print_herbivore );
@@ -1075,6 +1382,403 @@ int main() {
     test(encounter_specialization<string(Carnivore&, Animal&)>::next(w, w), "ignore");
   }
 
+  {
+    cout << "\n--- Memory statistics." << endl;
+
+    auto stats = yorel::methods::memory_stats();
+    auto stats_of = [&](const method_base* pm) {
+      return *find_if(stats.methods.begin(), stats.methods.end(),
+                      [=](const method_statistics& ms) { return ms.method == pm; });
+    };
+
+    auto grouping_display = stats_of(grouping_resolver_tests::display.impl);
+    test(string(grouping_display.name), "display");
+    test(grouping_display.dimensions, 2);
+    test(grouping_display.specializations, 5);
+    test(grouping_display.cells, 12);
+    test(grouping_display.undefined_cells, 5);
+    test(grouping_display.ambiguous_cells, 0);
+#ifdef YOMM11_COMPACT_DISPATCH
+    // the cells, then a target per specialization, undefined and ambiguous
+    test(grouping_display.bytes, 12 * sizeof(uint32_t) + 7 * sizeof(void(*)()));
+#else
+    test(grouping_display.bytes, 12 * sizeof(void(*)()));
+#endif
+
+    auto display = stats_of(single_inheritance::display.impl);
+    test(display.cells, 15);
+    test(display.undefined_cells, 4);
+    test(display.ambiguous_cells, 1);
+    test(display.ambiguous_ratio(), 1. / 15);
+    test(display.fill_ratio(), 10. / 15);
+
+    test(grouping_display.groups.size(), 2);
+    test(grouping_display.groups[0] * grouping_display.groups[1], 12);
+    test(grouping_display.duplicate_rows[0], 0);
+    test(grouping_display.duplicate_rows[1], 0);
+    test(display.groups[0] * display.groups[1], 15);
+    test(display.duplicate_rows[0], 0);
+    test(display.duplicate_rows[1], 0);
+
+    //          Animal     Wolf
+    // Animal   0          wolf
+    // Male     male       amb
+    // Female   female     amb
+    // Herb+    herbivore  amb
+    // Stallion amb        amb
+    // Mare     amb        amb
+    auto mate = stats_of(mi::mate.impl);
+    test(mate.groups[0], 6);
+    test(mate.groups[1], 2);
+    test(mate.duplicate_rows[0], 1);
+    test(mate.duplicate_rows[1], 0);
+
+    ostringstream report;
+    yorel::methods::write_dispatch_report(report);
+    test(report.str().find("\"name\": \"display\"") != string::npos, true);
+    test(report.str().find("\"cells\": 15,\n      \"undefined\": 4,\n      \"ambiguous\": 1") != string::npos, true);
+
+    test(stats.mmt > 0, true);
+    test(stats.dispatch_tables >= grouping_display.bytes + display.bytes, true);
+    test(stats.masks > 0, true);
+    test(stats.specializations > 0, true);
+    test(stats.foreign_classes > 0, true);
+    test(stats.total(),
+         stats.mmt + stats.dispatch_tables + stats.masks + stats.specializations
+         + stats.foreign_classes + stats.to_initialize);
+  }
+
+  {
+    cout << "\n--- Dispatch arena." << endl;
+
+    using namespace single_inheritance;
+
+    auto& animal = yomm11_class::of<Animal>::the().mmt;
+    auto& herbivore = yomm11_class::of<Herbivore>::the().mmt;
+    test(in_arena(animal.entries), true);
+    test(herbivore.entries == animal.entries + animal.size(), true);
+
+    auto table = encounter.impl->dispatch_table;
+    test(in_arena(table), true);
+    test(reinterpret_cast<size_t>(table) % arena_builder::cache_line, 0);
+    test(in_arena(encounter.impl->dispatch.load()), true);
+    testx( (void*) encounter.impl->dispatch.load()->table, (void*) table );
+    test( first_cell(*encounter.impl, animal[encounter.impl->slots[0]]), 0 );
+
+    Cow c;
+    Wolf w;
+    test(encounter(c, w), "run");
+    test(encounter(w, w), "wag tail");
+
+    enable_huge_pages();
+    encounter.the().invalidate();
+    yorel::methods::initialize();
+    enable_huge_pages(false);
+    test(in_arena(encounter.impl->dispatch_table), true);
+    test(encounter(c, w), "run");
+  }
+
+  {
+    cout << "\n--- Slot sharing." << endl;
+
+    using namespace slot_sharing;
+
+    yorel::methods::initialize();
+
+    Shape shape;
+    Circle circle;
+    Square square;
+    Disk disk;
+
+    // second arguments of intersect and overlap fall in the same groups
+    test(intersect.the().slots[1] == overlap.the().slots[1], true);
+    test(intersect.the().shared_slots[1], true);
+    test(overlap.the().shared_slots[0], false);
+#ifdef YOMM11_COMPACT_DISPATCH
+    // the first arguments share too
+    test(yomm11_class::of<Shape>::the().mmt.size(), 2);
+#else
+    test(yomm11_class::of<Shape>::the().mmt.size(), 3);
+#endif
+
+    test(intersect(circle, circle), "circles");
+    test(intersect(square, circle), "shapes");
+    test(overlap(square, circle), "square, circle");
+    test(overlap(square, square), "shapes");
+
+    // Disk behaves like Circle, they have the same row
+    auto& circle_row = yomm11_class::of<Circle>::the().mmt;
+    auto& disk_row = yomm11_class::of<Disk>::the().mmt;
+    test(disk_row.entries == circle_row.entries, true);
+    test(intersect(disk, circle), "circles");
+
+    // writing goes to a private draft, publishing it unshares the row
+    auto circle_entries = circle_row.entries.load();
+    disk_row[0] = disk_row[0];
+    test(disk_row.draft != nullptr, true);
+    test(disk_row.entries == circle_entries, true);
+    disk_row.publish();
+    test(disk_row.entries != circle_entries, true);
+    test(circle_row.entries == circle_entries, true);
+    test(intersect(disk, circle), "circles");
+
+    std::remove_const<decltype(overlap)>::type::specialize<overlap_shape_square>();
+    yorel::methods::initialize();
+
+    test(intersect.the().slots[1] != overlap.the().slots[1], true);
+#ifdef YOMM11_COMPACT_DISPATCH
+    // with the first argument of intersect
+    test(intersect.the().shared_slots[1], true);
+    test(intersect.the().slots[1] == intersect.the().slots[0], true);
+    test(yomm11_class::of<Shape>::the().mmt.size(), 3);
+#else
+    test(intersect.the().shared_slots[1], false);
+    test(yomm11_class::of<Shape>::the().mmt.size(), 4);
+#endif
+
+    test(intersect(circle, circle), "circles");
+    test(intersect(circle, square), "shapes");
+    test(overlap(square, circle), "square, circle");
+    test(overlap(circle, square), "shape, square");
+    test(yomm11_class::of<Disk>::the().mmt.entries == yomm11_class::of<Circle>::the().mmt.entries, true);
+  }
+
+  {
+    cout << "\n--- Concurrent initialize." << endl;
+
+    using namespace single_inheritance;
+
+    Cow c;
+    Wolf w;
+
+    // a registered thread keeps what it may be reading alive
+    register_thread();
+    auto old_header = encounter.impl->dispatch.load();
+    int old_slot = old_header->slots_and_steps()[0];
+    encounter.the().invalidate();
+    yorel::methods::initialize();
+    test(encounter.impl->dispatch.load() != old_header, true);
+    // the new table is reached through a fresh column
+    test(encounter.impl->slots[0] != old_slot, true);
+    test(old_header->slots_and_steps()[0], old_slot);
+    test(reclaimer::pending() > 0, true);
+    test(encounter(c, w), "run");
+    quiescent_state();
+    yorel::methods::initialize();
+    test(reclaimer::pending(), 0);
+    unregister_thread();
+
+    // readers dispatch while the tables are rebuilt under them
+    const int reader_threads = 4;
+    atomic<int> registered(0), wrong(0);
+    atomic<bool> done(false);
+    vector<thread> readers;
+
+    for (int i = 0; i < reader_threads; i++) {
+      readers.push_back(thread([&]() {
+            register_thread();
+            ++registered;
+            Cow c;
+            Wolf w;
+            while (!done) {
+              for (int call = 0; call < 100; call++) {
+                if (encounter(c, w) != "run" || encounter(w, w) != "wag tail") {
+                  ++wrong;
+                }
+              }
+              quiescent_state();
+            }
+            unregister_thread();
+          }));
+    }
+
+    while (registered < reader_threads) {
+      this_thread::yield();
+    }
+
+    for (int i = 0; i < 200; i++) {
+      encounter.the().invalidate();
+      if (i % 2) {
+        yomm11_class::add_to_initialize(&yomm11_class::of<Animal>::the());
+      }
+      yorel::methods::initialize();
+    }
+
+    done = true;
+
+    for (auto& reader : readers) {
+      reader.join();
+    }
+
+    test(wrong.load(), 0);
+    yorel::methods::initialize();
+    test(reclaimer::pending(), 0);
+    test(encounter(c, w), "run");
+
+    // the old tables serve calls until the worker publishes the new ones
+    register_thread();
+    encounter.the().invalidate();
+    auto ready = initialize_async();
+
+    while (ready.wait_for(chrono::seconds(0)) != future_status::ready) {
+      if (encounter(c, w) != "run") {
+        ++wrong;
+      }
+      quiescent_state();
+    }
+
+    ready.get();
+    test(wrong.load(), 0);
+    test(encounter(c, w), "run");
+    unregister_thread();
+  }
+
+  {
+    cout << "\n--- Hot swap." << endl;
+
+    using namespace single_inheritance;
+    using hunt = encounter_specialization<string(Carnivore&, Animal&)>;
+    using fight = encounter_specialization<string(Carnivore&, Carnivore&)>;
+
+    Cow c;
+    Wolf w;
+    Tiger t;
+
+    yorel::methods::initialize();
+    auto table = encounter.impl->dispatch_table;
+    auto cells = decltype(encounter)::replace<hunt, stalk>();
+    test(encounter.impl->dispatch_table, table);
+    test(cells.empty(), false);
+    test(encounter(w, c), "stalk");
+    test(encounter(t, c), "stalk");
+    test(encounter(w, w), "wag tail");
+    test(encounter(c, w), "run");
+    // next pointers follow
+    test(fight::next(t, w), "stalk");
+    // and so do later re-computations
+    encounter.the().invalidate();
+    yorel::methods::initialize();
+    test(encounter(t, c), "stalk");
+
+    auto restored = decltype(encounter)::replace<hunt, hunt>();
+    test(restored == cells, true);
+    test(encounter(t, c), "hunt");
+    test(fight::next(t, w), "hunt");
+
+    bool thrown = false;
+    try {
+      using moo = encounter_specialization<string(Cow&, Cow&)>;
+      decltype(encounter)::replace<moo, moo>();
+    } catch (runtime_error&) {
+      thrown = true;
+    }
+    test(thrown, true);
+
+    // Carnivore and Wolf make up whole groups: only (Carnivore, Wolf)
+    // and (Tiger, Wolf) change
+    using wag_tail = encounter_specialization<string(Wolf&, Wolf&)>;
+    table = encounter.impl->dispatch_table;
+    cells = decltype(encounter)::insert<track>();
+    test(cells.size(), 1);
+#ifndef YOMM11_COMPACT_DISPATCH
+    test(encounter.impl->dispatch_table, table);
+#endif
+    test(encounter(t, w), "track");
+    test(encounter(w, w), "wag tail");
+    test(encounter(t, t), "fight");
+    test(wag_tail::next(w, w), "track");
+    test(track::next(t, w), "fight");
+    test(encounter.impl->undefined_cells, 0);
+
+    // Herbivore splits the group of Animal in the second dimension
+    thrown = false;
+    try {
+      decltype(encounter)::insert<graze>();
+    } catch (runtime_error&) {
+      thrown = true;
+    }
+    test(thrown, true);
+    test(encounter(c, c), "ignore");
+
+    decltype(encounter)::unspecialize<track>();
+    yorel::methods::initialize();
+    test(encounter(t, w), "fight");
+    test(wag_tail::next(w, w), "fight");
+  }
+
+  {
+    cout << "\n--- Parallel for each." << endl;
+
+    using namespace parallel_dispatch;
+
+    yorel::methods::initialize();
+
+    Shape shape;
+    Circle c1, c2;
+    Square square;
+    vector<atomic<int>> counts(3);
+    auto target = decltype(tally)::target(c1, counts);
+    test(target == decltype(tally)::target(c2, counts), true);
+    test(target == decltype(tally)::target(square, counts), false);
+
+    vector<unique_ptr<Shape>> shapes;
+
+    for (int i = 0; i < 100000; i++) {
+      switch (i % 7) {
+      case 0: shapes.emplace_back(new Shape); break;
+      case 1: case 2: case 3: shapes.emplace_back(new Circle); break;
+      default: shapes.emplace_back(new Square); break;
+      }
+    }
+
+    for (int threads : { 1, 3, 8 }) {
+      set_parallel_threads(threads);
+      for (auto& count : counts) {
+        count = 0;
+      }
+      parallel_for_each(tally, shapes, counts);
+      test(counts[0], 14286);
+      test(counts[1], 42858);
+      test(counts[2], 42856);
+    }
+
+    // raw pointers, and an empty range
+    vector<Shape*> pointers = { &shape, &c1, &square };
+    for (auto& count : counts) {
+      count = 0;
+    }
+    parallel_for_each(tally, pointers, counts);
+    test(counts[0] + 2 * counts[1] + 3 * counts[2], 6);
+    parallel_for_each(tally, vector<Shape*>(), counts);
+
+    bool thrown = false;
+    try {
+      parallel_for_each(check, shapes);
+    } catch (runtime_error&) {
+      thrown = true;
+    }
+    test(thrown, true);
+
+    // the helpers are busy with the outer call: the inner ones run on
+    // their calling threads
+    set_parallel_threads(4);
+    vector<Shape*> outer(20000, &c1);
+    for (auto& count : counts) {
+      count = 0;
+    }
+    parallel_for_each(nest, outer, pointers, counts);
+    test(counts[0], 20000);
+    test(counts[1], 20000);
+    test(counts[2], 20000);
+
+    // idle helpers do not hold back reclamation
+    tally.the().invalidate();
+    yorel::methods::initialize();
+    test(reclaimer::pending(), 0);
+
+    set_parallel_threads(0);
+  }
+
   cout << "\n--- multiple inheritance" << endl;
 
   {
@@ -1090,20 +1794,41 @@ int main() {
 
     yorel::methods::initialize();
 
-    testx( (void*) yomm11_class::of<Animal>::the().mmt[0].ptr,
-           (void*) encounter.impl->dispatch_table );
-
-    testx( (void*) yomm11_class::of<Herbivore>::the().mmt[0].ptr,
-           (void*) (encounter.impl->dispatch_table) );
-
-    testx( (void*) yomm11_class::of<Stallion>::the().mmt[0].ptr,
-           (void*) (encounter.impl->dispatch_table + 1) );
+    test( first_cell(*encounter.impl, yomm11_class::of<Animal>::the().mmt[0]), 0 );
+    test( first_cell(*encounter.impl, yomm11_class::of<Herbivore>::the().mmt[0]), 0 );
+    test( first_cell(*encounter.impl, yomm11_class::of<Stallion>::the().mmt[0]), 1 );
 
     test( encounter(animal, animal), "ignore" );
     test( encounter(herbivore, herbivore), "ignore" );
     test( encounter(stallion, mare), "court" );
     test( encounter(mare, mare), "ignore" );
     test( encounter(wolf, mare), "hunt" );
+
+    {
+      // classes registered since initialize() borrow the row of a class
+      // to which the same specializations apply - not necessarily
+      // their first base
+      auto& male = yomm11_class::of<Male>::the();
+      auto& predator = yomm11_class::of<Predator>::the();
+      yomm11_class werewolf_class("Werewolf");
+      werewolf_class.initialize({ &male, &predator });
+      test( yomm11_class::make_provisional_rows(), true );
+      test( first_cell(*encounter.impl, werewolf_class.mmt.latest()[0]),
+            first_cell(*encounter.impl, predator.mmt.latest()[0]) );
+      test( first_cell(*encounter.impl, werewolf_class.mmt.latest()[0])
+            != first_cell(*encounter.impl, male.mmt.latest()[0]), true );
+
+      // both court and hunt apply: there are no cells for it yet
+      yomm11_class centaur_class("Centaur");
+      centaur_class.initialize({ &yomm11_class::of<Stallion>::the(), &predator });
+      test( yomm11_class::make_provisional_rows(), false );
+      test( centaur_class.mmt.size(), 0 );
+
+      yorel::methods::initialize();
+      test( centaur_class.mmt.size() != 0, true );
+    }
+
+    yorel::methods::initialize();
   }
 
   {
@@ -1164,7 +1889,7 @@ int main() {
     cout << "\n--- Unloading classes." << endl;
     {
       // fake a class
-      yomm11_class donkey_class YOMM11_TRACE(("Donkey"));
+      yomm11_class donkey_class("Donkey");
       donkey_class.initialize(yomm11_class_vector_of<Herbivore>::get());
       test( yomm11_class::to_initialize != nullptr, true );
       test( yomm11_class::to_initialize->size(), 1 );
@@ -1172,10 +1897,49 @@ int main() {
       test( !yomm11_class::to_initialize, true );
     }
 
-    test( yomm11_class::to_initialize != nullptr, true );
-    test( yomm11_class::to_initialize->size(), 1 );
-    yorel::methods::initialize();
+    // a leaf that shares its groups leaves everything in place
     test( !yomm11_class::to_initialize, true );
+    test( !method_base::to_initialize, true );
+
+    {
+      // a hierarchy whose root is destroyed before the class derived
+      // from it; unloading a leaf with a specialization of its own is
+      // tested by dl_unload
+      auto fern = new yomm11_class("Fern");
+      fern->initialize({ });
+      auto frond = new yomm11_class("Frond");
+      frond->initialize({ fern });
+      yorel::methods::initialize();
+      delete fern;
+      test( frond->root == nullptr, true );
+      test( !yomm11_class::to_initialize, true );
+      delete frond;
+    }
+
+    {
+      // the method outlives the class it dispatches on
+      using namespace unloaded;
+      yorel::methods::initialize();
+      Spore spore;
+      test( germinate(spore), 1 );
+      auto impl = &germinate.the();
+      auto& spore_class = yomm11_class::of<Spore>::the();
+      spore_class.unregister();
+      // as for the descendants of an unloaded class
+      spore_class.root = nullptr;
+      test( &germinate.the() == impl, true );
+      test( impl->buried, true );
+      test( impl->methods.size(), 0 );
+      test( throws<undefined>([&]() { germinate(spore); }), true );
+    }
+
+    test( display.the().methods.size(), 8 );
+    test( !yomm11_class::to_initialize, true );
+    test( !method_base::to_initialize, true );
+    yorel::methods::initialize();
+    Cow cow;
+    Terminal terminal;
+    test( display(cow, terminal), print_cow );
   }
 
   {
@@ -1237,6 +2001,21 @@ int main() {
     test( mx(xy), 1 );
     test( my(xy), 2 );
     test( mxy(xy), 3 );
+
+    XYZ xyz;
+    test( throws<undefined>([&]() { mx(xyz); }), true );
+  }
+
+  {
+    cout << "\n--- Foreign classes registered outside of their namespace." << endl;
+    using namespace foreign_other_namespace;
+
+    geo::shape shape;
+    geo::circle circle;
+
+    test( sides(shape), -1 );
+    test( sides(circle), 0 );
+    test( string(yomm11_class::of<geo::circle>::pc->name), "circle" );
   }
 
   {
@@ -1260,6 +2039,53 @@ int main() {
     test( mx(b), 17 );
   }
 
+  {
+    cout << "\n--- Tracing." << endl;
+    using namespace single_inheritance;
+
+    vector<trace_event> events;
+    set_trace_sink([&](const trace_event& event) { events.push_back(event); });
+    {
+      yomm11_class zebra_class("Zebra");
+      zebra_class.initialize(yomm11_class_vector_of<Herbivore>::get());
+      display.the().invalidate();
+      yorel::methods::initialize();
+    }
+    set_trace_sink(nullptr);
+    yorel::methods::initialize();
+
+    auto count = [&](trace_event::type kind) {
+      return count_if(events.begin(), events.end(), [=](const trace_event& event) { return event.kind == kind; });
+    };
+
+    test( events.empty(), false );
+    test( events[0].kind, trace_event::class_registered );
+    test( string(events[0].classes.front()), "Zebra" );
+    test( events[1].kind, trace_event::initialize_begin );
+    test( events.back().kind, trace_event::initialize_end );
+    test( count(trace_event::slot_assigned) > 0, true );
+    test( count(trace_event::group_created) > 0, true );
+    test( count(trace_event::cell_emitted) > 0, true );
+
+    auto cell = find_if(events.begin(), events.end(), [](const trace_event& event) {
+        return event.kind == trace_event::cell_emitted && event.specialization == "(Cow, Terminal)";
+      });
+    test( cell != events.end(), true );
+
+    ostringstream os;
+    if (cell != events.end()) {
+      write_json(os, *cell);
+    }
+    test( os.str().find("\"event\": \"cell_emitted\", \"method\": ") == 0, true );
+    test( os.str().find("\"specialization\": \"(Cow, Terminal)\"") != string::npos, true );
+
+    // disabled: nothing is recorded
+    size_t recorded = events.size();
+    display.the().invalidate();
+    yorel::methods::initialize();
+    test( events.size(), recorded );
+  }
+
   cout << "\n" << success << " tests succeeded, " << failure << " failed.\n";
 
   return 0;
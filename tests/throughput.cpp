@@ -0,0 +1,151 @@
+// throughput.cpp
+// Copyright (c) 2013 Jean-Louis Leroy
+// Distributed under the Boost Software License, Version 1.0. (See
+// accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+// Runs the scenarios of benchmarks.cpp from 1 to N threads, each pinned
+// to a core, all calling through the same objects. Dispatch only reads
+// shared state, so calls per second per thread should stay flat as
+// threads are added; a drop points at contention or false sharing.
+// The harness in util/bench.hpp times one thread at a time, so this
+// program keeps its own loop and is not part of run_benchmarks.
+
+// ./throughput [max threads] [iterations per thread]
+
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <string>
+#include <functional>
+#include "benchmarks_methods.hpp"
+#include "util/bench.hpp"
+
+#ifdef __linux__
+#include <pthread.h>
+#endif
+
+using namespace std;
+using namespace std::chrono;
+
+namespace {
+
+void pin(thread& t, int core) {
+#ifdef __linux__
+  cpu_set_t cpus;
+  CPU_ZERO(&cpus);
+  CPU_SET(core, &cpus);
+  pthread_setaffinity_np(t.native_handle(), sizeof(cpus), &cpus);
+#endif
+}
+
+// Returns the calls per second achieved by each thread, on average.
+double run(int threads, int repeats, const function<void(int)>& calls) {
+  const int cores = max(1u, thread::hardware_concurrency());
+  atomic<int> ready(0);
+  atomic<bool> go(false);
+  vector<double> seconds(threads);
+  vector<thread> workers;
+
+  for (int i = 0; i < threads; i++) {
+    workers.push_back(thread([&, i]() {
+          ++ready;
+          while (!go) {
+            this_thread::yield();
+          }
+          auto start = steady_clock::now();
+          calls(repeats);
+          seconds[i] = duration<double>(steady_clock::now() - start).count();
+        }));
+    pin(workers.back(), i % cores);
+  }
+
+  while (ready < threads) {
+    this_thread::yield();
+  }
+
+  go = true;
+
+  for (auto& worker : workers) {
+    worker.join();
+  }
+
+  double rate = 0;
+
+  for (double s : seconds) {
+    rate += repeats / s;
+  }
+
+  return rate / threads;
+}
+
+}
+
+int main(int argc, char** argv) {
+  yorel::multi_methods::initialize();
+
+  const int max_threads = argc > 1 ? stoi(argv[1]) : max(1u, thread::hardware_concurrency());
+  const int repeats = argc > 2 ? stoi(argv[2]) : 10 * 1000 * 1000;
+
+  // shared by all the threads
+  auto pi = intrusive::object::make();
+  auto pf = new foreign::object;
+  auto pv = vbase::object::make();
+
+  struct scenario {
+    string label;
+    function<void(int)> calls;
+  };
+
+  vector<scenario> scenarios = {
+    { "virtual function, do_nothing", [&](int n) { for (int i = 0; i < n; i++) pi->do_nothing(); } },
+    { "open method, intrusive, do_nothing", [&](int n) { for (int i = 0; i < n; i++) intrusive::do_nothing(*pi); } },
+    { "open method, foreign, do_nothing", [&](int n) { for (int i = 0; i < n; i++) foreign::do_nothing(*pf); } },
+    { "open method, vbase, do_nothing", [&](int n) { for (int i = 0; i < n; i++) vbase::do_nothing(*pv); } },
+    { "open method, intrusive, do_something", [&](int n) { for (int i = 0; i < n; i++) bench::do_not_optimize(intrusive::do_something(*pi, 1, 2, 3, 4)); } },
+    { "open method, foreign, do_something", [&](int n) { for (int i = 0; i < n; i++) bench::do_not_optimize(foreign::do_something(*pf, 1, 2, 3, 4)); } },
+    { "open method, vbase, do_something", [&](int n) { for (int i = 0; i < n; i++) bench::do_not_optimize(vbase::do_something(*pv, 1, 2, 3, 4)); } },
+    { "open method with 2 args, intrusive, do_nothing", [&](int n) { for (int i = 0; i < n; i++) intrusive::do_nothing_2(*pi, *pi); } },
+    { "open method with 2 args, foreign, do_nothing", [&](int n) { for (int i = 0; i < n; i++) foreign::do_nothing_2(*pf, *pf); } },
+    { "open method with 2 args, vbase, do_nothing", [&](int n) { for (int i = 0; i < n; i++) vbase::do_nothing_2(*pv, *pv); } },
+  };
+
+  vector<int> thread_counts;
+
+  for (int threads = 1; threads < max_threads; threads *= 2) {
+    thread_counts.push_back(threads);
+  }
+
+  thread_counts.push_back(max_threads);
+
+#ifdef YOMM11_COMPACT_DISPATCH
+  cout << "compact dispatch tables\n";
+#else
+  cout << "pointer dispatch tables\n";
+#endif
+  cout << repeats << " iterations per thread, "
+       << "millions of calls per second per thread (scaling efficiency)\n";
+
+  for (auto& s : scenarios) {
+    cout << setw(50) << left << s.label << ":";
+    double single = 0;
+
+    for (int threads : thread_counts) {
+      double rate = run(threads, repeats, s.calls);
+
+      if (threads == 1) {
+        single = rate;
+      }
+
+      cout << " " << threads << ": " << fixed << setprecision(1) << rate / 1e6
+           << " (" << setprecision(0) << 100 * rate / single << "%)" << flush;
+    }
+
+    cout << endl;
+  }
+
+  return 0;
+}
@@ -0,0 +1,609 @@
+#ifndef BENCH_HPP
+#define BENCH_HPP
+
+// bench.hpp
+// Copyright (c) 2013 Jean-Louis Leroy
+// Distributed under the Boost Software License, Version 1.0. (See
+// accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+// A small benchmark harness. Each scenario is a function that performs
+// a given number of calls. The harness finds a number of calls that
+// takes at least --min-time seconds, runs a few warmup repetitions,
+// then times --repetitions repetitions and reports the median, the
+// 10th and 90th percentiles and the minimum in ns per call. With
+// --json, the samples and the statistics are written to a file, with
+// the context of the run: the dispatch encoding, the compiler, and
+// what the program adds with context().
+//
+// With --baseline, the results are compared with those in a file
+// written by --json. For each scenario found in both, a 95% confidence
+// interval of the ratio of the medians - current / baseline - is
+// estimated by resampling the samples of both runs. If the whole
+// interval lies above 1 + --threshold percent (default 10), the
+// scenario has regressed, and the program exits with status 1. With
+// --normalize, the times of each run are divided by the median time of
+// the given scenario of the same run, so a baseline recorded on one
+// machine can be used on another.
+//
+//   ./benchmarks [--filter text] [--repetitions n] [--warmup n]
+//                [--min-time seconds] [--json file]
+//                [--baseline file] [--threshold percent]
+//                [--normalize scenario]
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace bench {
+
+// Forces the compiler to materialize 'value', and to assume that it
+// is read - so neither it nor the computation that produced it can be
+// hoisted out of a loop or eliminated.
+template<typename T>
+inline void do_not_optimize(T const& value) {
+#if defined(__GNUC__)
+  asm volatile("" : : "r,m"(value) : "memory");
+#else
+  static volatile const void* sink;
+  sink = &value;
+#endif
+}
+
+// Forces the compiler to assume that all memory was read and written.
+inline void clobber() {
+#if defined(__GNUC__)
+  asm volatile("" : : : "memory");
+#endif
+}
+
+struct statistics {
+  double median, p10, p90, min, mean, stddev;
+};
+
+// linear interpolation between the closest ranks; 'sorted' is not empty
+inline double percentile(const std::vector<double>& sorted, double p) {
+  double rank = p / 100 * (sorted.size() - 1);
+  size_t below = size_t(rank);
+  size_t above = std::min(below + 1, sorted.size() - 1);
+  return sorted[below] + (rank - below) * (sorted[above] - sorted[below]);
+}
+
+inline statistics compute(std::vector<double> samples) {
+  std::sort(samples.begin(), samples.end());
+  statistics s;
+  s.median = percentile(samples, 50);
+  s.p10 = percentile(samples, 10);
+  s.p90 = percentile(samples, 90);
+  s.min = samples.front();
+  s.mean = 0;
+
+  for (double x : samples) {
+    s.mean += x;
+  }
+
+  s.mean /= samples.size();
+  s.stddev = 0;
+
+  for (double x : samples) {
+    s.stddev += (x - s.mean) * (x - s.mean);
+  }
+
+  s.stddev = samples.size() > 1 ? std::sqrt(s.stddev / (samples.size() - 1)) : 0;
+
+  return s;
+}
+
+struct result {
+  std::string name;
+  size_t calls;                 // per repetition
+  std::vector<double> samples;  // ns per call, one per repetition
+  statistics stats;
+  std::vector<std::pair<std::string, double>> counters;
+};
+
+inline void write_json_string(std::ostream& os, const std::string& s) {
+  os << '"';
+  for (char c : s) {
+    if (c == '"' || c == '\\') {
+      os << '\\';
+    }
+    os << c;
+  }
+  os << '"';
+}
+
+// Just enough JSON to read back what runner::write() writes.
+struct json {
+  enum type { null, boolean, number, string, array, object };
+
+  type kind = null;
+  double value = 0;
+  std::string text;
+  std::vector<json> elements;
+  std::vector<std::pair<std::string, json>> members;
+
+  const json* find(const std::string& key) const {
+    for (auto& member : members) {
+      if (member.first == key) {
+        return &member.second;
+      }
+    }
+    return nullptr;
+  }
+
+  // throws std::runtime_error
+  static json parse(std::istream& is) {
+    json result = parse_value(is);
+    is >> std::ws;
+
+    if (!is.eof()) {
+      fail("trailing characters");
+    }
+
+    return result;
+  }
+
+ private:
+  static void fail(const std::string& what) {
+    throw std::runtime_error("json: " + what);
+  }
+
+  static void expect(std::istream& is, char c) {
+    if (!(is >> std::ws) || is.get() != c) {
+      fail(std::string("expected ") + c);
+    }
+  }
+
+  static std::string parse_string(std::istream& is) {
+    expect(is, '"');
+    std::string result;
+
+    for (;;) {
+      int c = is.get();
+
+      if (c == EOF) {
+        fail("unterminated string");
+      } else if (c == '"') {
+        return result;
+      } else if (c == '\\') {
+        c = is.get();
+        result += c == 'n' ? '\n' : c == 't' ? '\t' : char(c);
+      } else {
+        result += char(c);
+      }
+    }
+  }
+
+  static json parse_value(std::istream& is) {
+    json v;
+    is >> std::ws;
+    int c = is.peek();
+
+    if (c == '{') {
+      v.kind = object;
+      is.get();
+
+      if ((is >> std::ws).peek() == '}') {
+        is.get();
+        return v;
+      }
+
+      do {
+        std::string key = parse_string(is);
+        expect(is, ':');
+        v.members.push_back(std::make_pair(key, parse_value(is)));
+      } while ((is >> std::ws).peek() == ',' && is.get());
+
+      expect(is, '}');
+    } else if (c == '[') {
+      v.kind = array;
+      is.get();
+
+      if ((is >> std::ws).peek() == ']') {
+        is.get();
+        return v;
+      }
+
+      do {
+        v.elements.push_back(parse_value(is));
+      } while ((is >> std::ws).peek() == ',' && is.get());
+
+      expect(is, ']');
+    } else if (c == '"') {
+      v.kind = string;
+      v.text = parse_string(is);
+    } else if (c == 't' || c == 'f' || c == 'n') {
+      std::string word;
+      while (isalpha(is.peek())) {
+        word += char(is.get());
+      }
+      if (word == "true" || word == "false") {
+        v.kind = boolean;
+        v.value = word == "true";
+      } else if (word != "null") {
+        fail("unexpected " + word);
+      }
+    } else {
+      v.kind = number;
+      if (!(is >> v.value)) {
+        fail("expected a value");
+      }
+    }
+
+    return v;
+  }
+};
+
+// the scenarios and their samples in a file written by runner::write()
+inline std::vector<result> read_results(const std::string& file) {
+  std::ifstream is(file);
+
+  if (!is) {
+    throw std::runtime_error("cannot read " + file);
+  }
+
+  json doc = json::parse(is);
+  const json* benchmarks = doc.find("benchmarks");
+
+  if (!benchmarks) {
+    throw std::runtime_error(file + ": no benchmarks");
+  }
+
+  std::vector<result> results;
+
+  for (auto& b : benchmarks->elements) {
+    const json* name = b.find("name");
+    const json* samples = b.find("samples");
+
+    if (!name || !samples || samples->elements.empty()) {
+      throw std::runtime_error(file + ": benchmark without name or samples");
+    }
+
+    result r;
+    r.name = name->text;
+    r.calls = 0;
+
+    for (auto& x : samples->elements) {
+      r.samples.push_back(x.value);
+    }
+
+    r.stats = compute(r.samples);
+    results.push_back(r);
+  }
+
+  return results;
+}
+
+// divides all the samples by the median of 'reference'; returns false
+// if there is no such scenario
+inline bool normalize(std::vector<result>& results, const std::string& reference) {
+  double unit = 0;
+
+  for (auto& r : results) {
+    if (r.name == reference) {
+      unit = r.stats.median;
+    }
+  }
+
+  if (unit <= 0) {
+    return false;
+  }
+
+  for (auto& r : results) {
+    for (double& x : r.samples) {
+      x /= unit;
+    }
+    r.stats = compute(r.samples);
+  }
+
+  return true;
+}
+
+// 95% confidence interval of median(current) / median(baseline),
+// estimated by bootstrap - resampling both sets with replacement
+inline std::pair<double, double> ratio_interval(
+  const std::vector<double>& current, const std::vector<double>& baseline) {
+  const int resamples = 2000;
+  std::mt19937 random;
+  std::vector<double> ratios, a(current.size()), b(baseline.size());
+
+  for (int i = 0; i < resamples; i++) {
+    for (auto& x : a) {
+      x = current[random() % current.size()];
+    }
+    for (auto& x : b) {
+      x = baseline[random() % baseline.size()];
+    }
+    ratios.push_back(compute(a).median / compute(b).median);
+  }
+
+  std::sort(ratios.begin(), ratios.end());
+
+  return std::make_pair(percentile(ratios, 2.5), percentile(ratios, 97.5));
+}
+
+class runner {
+ public:
+  runner(int argc, char** argv) {
+    for (int i = 1; i < argc; i++) {
+      std::string arg = argv[i];
+      const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+
+      if (!value) {
+        usage(argv[0]);
+      } else if (arg == "--filter") {
+        filter = value;
+      } else if (arg == "--repetitions") {
+        repetitions = std::max(1, std::atoi(value));
+      } else if (arg == "--warmup") {
+        warmup = std::max(0, std::atoi(value));
+      } else if (arg == "--min-time") {
+        min_time = std::atof(value);
+      } else if (arg == "--json") {
+        json = value;
+      } else if (arg == "--baseline") {
+        baseline = value;
+      } else if (arg == "--threshold") {
+        threshold = std::atof(value);
+      } else if (arg == "--normalize") {
+        reference = value;
+      } else {
+        usage(argv[0]);
+      }
+
+      ++i;
+    }
+
+#ifdef YOMM11_COMPACT_DISPATCH
+    context("dispatch", "compact");
+#else
+    context("dispatch", "pointer");
+#endif
+#ifdef __VERSION__
+    context("compiler", __VERSION__);
+#endif
+  }
+
+  // describes the conditions of the run, e.g. ("classes", "100")
+  void context(const std::string& key, const std::string& value) {
+    contexts.push_back(std::make_pair(key, value));
+  }
+
+  bool selected(const std::string& name) const {
+    return name.find(filter) != std::string::npos;
+  }
+
+  // 'body(n)' makes n calls; returns false if filtered out
+  bool run(const std::string& name, const std::function<void(size_t)>& body) {
+    if (!selected(name)) {
+      return false;
+    }
+
+    result r;
+    r.name = name;
+    r.calls = calibrate(body);
+
+    for (int i = 0; i < warmup; i++) {
+      time(body, r.calls);
+    }
+
+    for (int i = 0; i < repetitions; i++) {
+      r.samples.push_back(time(body, r.calls) * 1e9 / r.calls);
+    }
+
+    r.stats = compute(r.samples);
+    results.push_back(r);
+
+    std::cout << std::setw(56) << std::left << name << std::right;
+    cell(r.stats.median);
+    cell(r.stats.p10);
+    cell(r.stats.p90);
+    cell(r.stats.min);
+    std::cout << std::endl;
+
+    return true;
+  }
+
+  // attaches a measurement, e.g. a table size, to the last scenario
+  void counter(const std::string& key, double value) {
+    if (!results.empty()) {
+      results.back().counters.push_back(std::make_pair(key, value));
+    }
+  }
+
+  // prints the column headings
+  void header(const std::string& title) const {
+    std::cout << title << ", ns per call\n"
+              << std::setw(56) << std::left << "" << std::right
+              << std::setw(12) << "median" << std::setw(12) << "p10"
+              << std::setw(12) << "p90" << std::setw(12) << "min" << std::endl;
+  }
+
+  // writes the JSON file and compares with the baseline, if requested;
+  // returns the exit status
+  int finish() const {
+    if (!json.empty()) {
+      std::ofstream os(json);
+      write(os);
+
+      if (!os) {
+        std::cerr << "cannot write " << json << std::endl;
+        return 1;
+      }
+    }
+
+    if (!baseline.empty()) {
+      try {
+        return compare(read_results(baseline)) ? 0 : 1;
+      } catch (std::runtime_error& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+      }
+    }
+
+    return 0;
+  }
+
+  // prints a comparison with 'base'; returns false if a scenario regressed
+  bool compare(std::vector<result> base) const {
+    std::vector<result> current = results;
+
+    if (!reference.empty() && !(normalize(current, reference) && normalize(base, reference))) {
+      std::cerr << "no scenario '" << reference << "' to normalize with" << std::endl;
+      return false;
+    }
+
+    std::cout.unsetf(std::ios::floatfield);
+    std::cout.precision(6);
+    std::cout << "\ncompared with " << baseline
+              << (reference.empty() ? "" : ", relative to '" + reference + "'")
+              << ", regression threshold " << threshold << "%\n"
+              << std::setw(56) << std::left << "" << std::right
+              << std::setw(10) << "ratio" << std::setw(20) << "95% interval" << std::endl;
+
+    int regressions = 0;
+
+    for (auto& r : current) {
+      auto b = std::find_if(base.begin(), base.end(), [&](const result& b) { return b.name == r.name; });
+      std::cout << std::setw(56) << std::left << r.name << std::right;
+
+      if (b == base.end()) {
+        std::cout << std::setw(10) << "new" << std::endl;
+        continue;
+      }
+
+      auto interval = ratio_interval(r.samples, b->samples);
+      const char* verdict = "";
+
+      if (interval.first > 1 + threshold / 100) {
+        verdict = "  REGRESSION";
+        ++regressions;
+      } else if (interval.second < 1 - threshold / 100) {
+        verdict = "  faster";
+      }
+
+      std::ostringstream range;
+      range << std::fixed << std::setprecision(3) << "[" << interval.first << ", " << interval.second << "]";
+
+      std::cout << std::fixed << std::setprecision(3)
+                << std::setw(10) << r.stats.median / b->stats.median
+                << std::setw(20) << range.str()
+                << verdict << std::endl;
+    }
+
+    std::cout << regressions << " regression(s)" << std::endl;
+
+    return regressions == 0;
+  }
+
+  void write(std::ostream& os) const {
+    os << "{\n  \"context\": {";
+    const char* sep = "\n";
+
+    for (auto& kv : contexts) {
+      os << sep << "    ";
+      write_json_string(os, kv.first);
+      os << ": ";
+      write_json_string(os, kv.second);
+      sep = ",\n";
+    }
+
+    os << "\n  },\n  \"benchmarks\": [";
+    sep = "\n";
+
+    for (auto& r : results) {
+      os << sep << "    {\n      \"name\": ";
+      write_json_string(os, r.name);
+      os << ",\n      \"calls\": " << r.calls
+         << ",\n      \"ns_per_call\": { \"median\": " << r.stats.median
+         << ", \"p10\": " << r.stats.p10
+         << ", \"p90\": " << r.stats.p90
+         << ", \"min\": " << r.stats.min
+         << ", \"mean\": " << r.stats.mean
+         << ", \"stddev\": " << r.stats.stddev << " }";
+
+      for (auto& kv : r.counters) {
+        os << ",\n      ";
+        write_json_string(os, kv.first);
+        os << ": " << kv.second;
+      }
+
+      os << ",\n      \"samples\": [";
+      const char* comma = "";
+
+      for (double x : r.samples) {
+        os << comma << x;
+        comma = ", ";
+      }
+
+      os << "]\n    }";
+      sep = ",\n";
+    }
+
+    os << "\n  ]\n}\n";
+  }
+
+  std::string filter;
+  int repetitions = 20;
+  int warmup = 2;
+  double min_time = 0.01;
+  std::string json;
+  std::string baseline;
+  double threshold = 10;
+  std::string reference;
+  std::vector<std::pair<std::string, std::string>> contexts;
+  std::vector<result> results;
+
+ private:
+  static void cell(double ns) {
+    std::cout << std::fixed << std::setprecision(ns < 1e6 ? 2 : 0) << std::setw(12) << ns;
+  }
+
+  static double time(const std::function<void(size_t)>& body, size_t calls) {
+    auto start = std::chrono::steady_clock::now();
+    body(calls);
+    clobber();
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  }
+
+  // the number of calls that takes at least min_time
+  size_t calibrate(const std::function<void(size_t)>& body) const {
+    size_t calls = 1;
+
+    for (;;) {
+      double seconds = time(body, calls);
+
+      if (seconds >= min_time) {
+        return calls;
+      }
+
+      size_t guess = seconds > 0 ? size_t(calls * min_time / seconds * 1.2) : calls * 10;
+      calls = std::max(calls * 2, guess);
+    }
+  }
+
+  static void usage(const char* program) {
+    std::cerr << "usage: " << program
+              << " [--filter text] [--repetitions n] [--warmup n] [--min-time seconds] [--json file]"
+              << " [--baseline file] [--threshold percent] [--normalize scenario]"
+              << std::endl;
+    std::exit(2);
+  }
+};
+
+}
+
+#endif
@@ -0,0 +1,31 @@
+#ifndef FACTORIES_HPP
+#define FACTORIES_HPP
+
+// factories.hpp
+// Copyright (c) 2013 Jean-Louis Leroy
+// Distributed under the Boost Software License, Version 1.0. (See
+// accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+// A list of factories of type Factory, filled during static
+// initialization, typically by the macro that defines a class:
+//
+//   #define SHAPE(N)                                                  \
+//     struct shape ## N : shape { ... };                               \
+//     ADD_FACTORY(std::function<shape*()>, shape ## N,                 \
+//                 []() -> shape* { return new shape ## N; });
+//
+// The factories come in order of definition within a translation unit.
+
+#include <vector>
+
+template<typename Factory>
+std::vector<Factory>& factories() {
+  static std::vector<Factory> factories;
+  return factories;
+}
+
+#define ADD_FACTORY(FACTORY, ID, ...) \
+  const bool _factory_ ## ID = (factories<FACTORY>().push_back(__VA_ARGS__), true)
+
+#endif